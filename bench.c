@@ -0,0 +1,406 @@
+/*
+ * Allocation policy benchmark for the mem_pool library.
+ *
+ * Runs the same workloads against FIRST_FIT, BEST_FIT and GOOD_FIT
+ * (for a range of search limits) and reports the time per operation
+ * and the fragmentation of the free space at the end of the run. The
+ * ping-pong workload also runs with LIFO reuse of freed blocks.
+ *
+ * With the argument "scenarios" it replays the scenarios of the test
+ * suite instead, each many times over, with the fragmentation taken
+ * after the last allocation of the scenario.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mem_pool.h"
+
+
+/*****            constants            *****/
+
+static const unsigned BENCH_GOOD_FIT_LIMITS[] = {1, 2, 4, 8, 16, 32, 64};
+
+static const unsigned STRESS_NUM_ALLOCS     = 1000;
+static const unsigned STRESS_MIN_ALLOC_SIZE = 10;
+
+static const unsigned CHURN_POOL_SIZE       = 4000000;
+static const unsigned CHURN_NUM_LIVE        = 2000;
+static const unsigned CHURN_NUM_OPS         = 200000;
+static const unsigned CHURN_MAX_ALLOC_SIZE  = 2000;
+
+static const unsigned PINGPONG_POOL_SIZE    = 16000000;
+static const unsigned PINGPONG_NUM_BLOCKS   = 8192;
+static const unsigned PINGPONG_NUM_OPS      = 200000;
+static const unsigned PINGPONG_SIZE_STEP    = 256;
+
+static const unsigned SCENARIO_POOL_SIZE    = 1000000;
+static const unsigned SCENARIO_NUM_SLOTS    = 16;
+static const unsigned SCENARIO_REPEAT       = 10000;
+
+/*
+ * test_pool_scenario00 to 19 of test_suite.c as traces: "a3:500"
+ * allocates 500 into slot 3, "f3" frees the block in slot 3. The blocks
+ * a trace leaves allocated are freed in slot order, like the tests do.
+ */
+static const char * const SCENARIO_TRACES[] = {
+        "a0:100 f0",
+        "a0:100 f0 a0:100 f0",
+        "a0:100 a1:1000 f1 f0",
+        "a0:100 a1:1000 f0 f1",
+        "a0:100 a1:1000 a2:10000 f1 f0 f2",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:2000 f2 f3",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:500 f2 f3",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:1100 f2 f3",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:989000 f2",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:988000 f2 f3",
+        "a0:100 a1:1000 a2:10000 f1 f0 a3:988900 f2 f3",
+        "a0:100 f0",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f1 f2 f4 f8 f6 f7 a10:100",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f1 f4 f8 f6 f7 a10:100",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f4 f1 f8 f6 f7 a10:100",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f1 f2 f4 f8 f6 f7 a10:50 a11:50",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f7 f5 f3 f1 a10:50 a11:50",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f2 f1 f3 f6 f5 f8 a10:50 a11:50",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f2 f1 f3 f6 f5 f8 a10:999000 a11:350",
+        "a0:100 a1:100 a2:100 a3:100 a4:100 a5:100 a6:100 a7:100 a8:100 a9:100 "
+                "f2 f1 f3 f6 f5 f8 a10:150",
+};
+
+
+/*****              types              *****/
+
+typedef struct _bench_result {
+    double ns_per_op;
+    unsigned failed;
+    double fragmentation; // 1 - largest gap / free bytes
+    unsigned num_gaps;
+} bench_result_t, *bench_result_pt;
+
+typedef struct _bench_op {
+    unsigned slot;
+    size_t size; // 0 frees the block in the slot
+} bench_op_t, *bench_op_pt;
+
+typedef void (*bench_workload_fn)(pool_pt pool, const void *arg, bench_result_pt result);
+
+
+/*****         helper routines         *****/
+
+static double now_ns() {
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// deterministic pseudo-random numbers, so every policy sees the same trace
+static unsigned next_random(unsigned long long *seed) {
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+    return (unsigned) (*seed >> 33);
+}
+
+static void measure_fragmentation(pool_pt pool, bench_result_pt result) {
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    size_t free_size = 0;
+    size_t largest_gap = 0;
+
+    mem_inspect_pool(pool, &segs, &num_segs);
+
+    for (unsigned u = 0; u < num_segs; u ++) {
+        if (! segs[u].allocated) {
+            free_size += segs[u].size;
+            if (segs[u].size > largest_gap) largest_gap = segs[u].size;
+        }
+    }
+    free(segs);
+
+    result->fragmentation = free_size ? 1.0 - (double) largest_gap / free_size : 0.0;
+    result->num_gaps = pool->num_gaps;
+}
+
+
+/*****            workloads            *****/
+
+static size_t stress_pool_size() {
+    return (STRESS_NUM_ALLOCS / 2) *
+           (2 * STRESS_MIN_ALLOC_SIZE + (STRESS_NUM_ALLOCS - 1) * STRESS_MIN_ALLOC_SIZE);
+}
+
+/*
+ * The pattern of test_pool_stresstest0 on one pool: allocate growing
+ * sizes until the pool is full, free every other one, then fill the
+ * holes again with a shuffled mix of the freed sizes.
+ */
+static void workload_stress(pool_pt pool, const void *arg, bench_result_pt result) {
+    void *allocs[STRESS_NUM_ALLOCS];
+    unsigned long long seed = 42;
+    unsigned num_ops = 0;
+    double start = now_ns();
+
+    (void) arg;
+
+    for (unsigned u = 0; u < STRESS_NUM_ALLOCS; ++u, ++num_ops) {
+        allocs[u] = mem_new_alloc(pool, (u + 1) * STRESS_MIN_ALLOC_SIZE);
+        if (! allocs[u]) result->failed ++;
+    }
+    for (unsigned u = 1; u < STRESS_NUM_ALLOCS; u += 2, ++num_ops) {
+        if (allocs[u]) mem_del_alloc(pool, allocs[u]);
+        allocs[u] = NULL;
+    }
+    for (unsigned u = 1; u < STRESS_NUM_ALLOCS; u += 2, ++num_ops) {
+        unsigned size = (next_random(&seed) % STRESS_NUM_ALLOCS + 1) * STRESS_MIN_ALLOC_SIZE / 2;
+        allocs[u] = mem_new_alloc(pool, size);
+        if (! allocs[u]) result->failed ++;
+    }
+
+    result->ns_per_op = (now_ns() - start) / num_ops;
+    measure_fragmentation(pool, result);
+
+    for (unsigned u = 0; u < STRESS_NUM_ALLOCS; ++u) {
+        if (allocs[u]) mem_del_alloc(pool, allocs[u]);
+    }
+}
+
+/*
+ * Random churn with a fixed-size live set: each step frees a random
+ * live block and allocates a new one of a random size.
+ */
+static void workload_churn(pool_pt pool, const void *arg, bench_result_pt result) {
+    void **allocs = calloc(CHURN_NUM_LIVE, sizeof(void *));
+    unsigned long long seed = 7;
+    double start;
+
+    (void) arg;
+
+    for (unsigned u = 0; u < CHURN_NUM_LIVE; ++u) {
+        allocs[u] = mem_new_alloc(pool, next_random(&seed) % CHURN_MAX_ALLOC_SIZE + 1);
+    }
+
+    start = now_ns();
+    for (unsigned op = 0; op < CHURN_NUM_OPS; ++op) {
+        unsigned victim = next_random(&seed) % CHURN_NUM_LIVE;
+
+        if (allocs[victim]) mem_del_alloc(pool, allocs[victim]);
+        allocs[victim] = mem_new_alloc(pool, next_random(&seed) % CHURN_MAX_ALLOC_SIZE + 1);
+        if (! allocs[victim]) result->failed ++;
+    }
+    result->ns_per_op = (now_ns() - start) / (2 * CHURN_NUM_OPS);
+    measure_fragmentation(pool, result);
+
+    for (unsigned u = 0; u < CHURN_NUM_LIVE; ++u) {
+        if (allocs[u]) mem_del_alloc(pool, allocs[u]);
+    }
+    free(allocs);
+}
+
+/*
+ * Alloc/free ping-pong over a working set larger than the caches: every
+ * 4th block is freed up front and stays cold, then each step writes a
+ * random live block (one with live neighbours), frees it, allocates one
+ * of the same size and writes that. A hot reuse hands back the block
+ * just written.
+ */
+static void workload_pingpong(pool_pt pool, const void *arg, bench_result_pt result) {
+    void **allocs = calloc(PINGPONG_NUM_BLOCKS, sizeof(void *));
+    unsigned long long seed = 11;
+    double start;
+
+    (void) arg;
+
+    for (unsigned u = 0; u < PINGPONG_NUM_BLOCKS; ++u) {
+        allocs[u] = mem_new_alloc(pool, (next_random(&seed) % 4 + 1) * PINGPONG_SIZE_STEP);
+    }
+    for (unsigned u = 0; u < PINGPONG_NUM_BLOCKS; u += 4) {
+        if (allocs[u]) mem_del_alloc(pool, allocs[u]);
+        allocs[u] = NULL;
+    }
+
+    start = now_ns();
+    for (unsigned op = 0; op < PINGPONG_NUM_OPS; ++op) {
+        unsigned victim = (next_random(&seed) % (PINGPONG_NUM_BLOCKS / 4)) * 4 + 2;
+        alloc_pt alloc = allocs[victim];
+        size_t size;
+
+        if (! alloc) continue;
+        size = alloc->size;
+        memset(alloc->mem, (int) op, size);
+        mem_del_alloc(pool, alloc);
+
+        alloc = mem_new_alloc(pool, size);
+        allocs[victim] = alloc;
+        if (! alloc) {
+            result->failed ++;
+            continue;
+        }
+        memset(alloc->mem, (int) op, size);
+    }
+    result->ns_per_op = (now_ns() - start) / (2 * PINGPONG_NUM_OPS);
+    measure_fragmentation(pool, result);
+
+    for (unsigned u = 0; u < PINGPONG_NUM_BLOCKS; ++u) {
+        if (allocs[u]) mem_del_alloc(pool, allocs[u]);
+    }
+    free(allocs);
+}
+
+// the operations of a trace, returns how many there are
+static unsigned parse_trace(const char *trace, bench_op_pt ops) {
+    unsigned num_ops = 0;
+    char *end = (char *) trace;
+
+    while (*end) {
+        char op = *end;
+
+        ops[num_ops].slot = (unsigned) strtoul(end + 1, &end, 10);
+        ops[num_ops].size = op == 'a' ? strtoul(end + 1, &end, 10) : 0;
+        num_ops ++;
+        while (*end == ' ') end ++;
+    }
+
+    return num_ops;
+}
+
+// one pass over a trace, returns the operations made; with a result, the
+// failures are counted and the fragmentation is taken after the last
+// allocation
+static unsigned replay_trace(pool_pt pool, const bench_op_t *ops, unsigned num_ops,
+                             bench_result_pt result) {
+    void *slots[SCENARIO_NUM_SLOTS];
+    unsigned last_alloc = 0;
+    unsigned num_made = 0;
+
+    memset(slots, 0, sizeof(slots));
+    for (unsigned u = 0; u < num_ops; ++u) {
+        if (ops[u].size) last_alloc = u;
+    }
+
+    for (unsigned u = 0; u < num_ops; ++u) {
+        unsigned slot = ops[u].slot;
+
+        if (ops[u].size) {
+            slots[slot] = mem_new_alloc(pool, ops[u].size);
+            num_made ++;
+            if (result && ! slots[slot]) result->failed ++;
+            if (result && u == last_alloc) measure_fragmentation(pool, result);
+        } else if (slots[slot]) {
+            mem_del_alloc(pool, slots[slot]);
+            slots[slot] = NULL;
+            num_made ++;
+        }
+    }
+    for (unsigned u = 0; u < SCENARIO_NUM_SLOTS; ++u) {
+        if (slots[u]) {
+            mem_del_alloc(pool, slots[u]);
+            num_made ++;
+        }
+    }
+
+    return num_made;
+}
+
+/*
+ * One of the scenarios of the test suite: a first pass for the failures
+ * and the fragmentation, then many timed ones (the pool is empty after
+ * each).
+ */
+static void workload_scenario(pool_pt pool, const void *arg, bench_result_pt result) {
+    const char *trace = arg;
+    bench_op_pt ops = calloc(strlen(trace) / 2 + 1, sizeof(bench_op_t));
+    unsigned num_ops = parse_trace(trace, ops);
+    unsigned long num_made = 0;
+    double start;
+
+    replay_trace(pool, ops, num_ops, result);
+
+    start = now_ns();
+    for (unsigned u = 0; u < SCENARIO_REPEAT; ++u) {
+        num_made += replay_trace(pool, ops, num_ops, NULL);
+    }
+    result->ns_per_op = (now_ns() - start) / num_made;
+
+    free(ops);
+}
+
+
+/*****          driver routine         *****/
+
+static void run_one(const char *workload_name, bench_workload_fn workload, const void *arg,
+                    size_t pool_size, alloc_policy policy, unsigned limit, unsigned lifo) {
+    bench_result_t result = {0};
+    const char *policy_name =
+            (policy == FIRST_FIT) ? "FIRST_FIT" : (policy == BEST_FIT) ? "BEST_FIT" : "GOOD_FIT";
+    char limit_str[16] = "-";
+
+    pool_pt pool = mem_pool_open(pool_size, policy);
+    if (! pool) {
+        fprintf(stderr, "cannot open a pool of %lu bytes\n", (unsigned long) pool_size);
+        exit(1);
+    }
+    if (policy == GOOD_FIT) {
+        mem_pool_set_search_limit(pool, limit);
+        snprintf(limit_str, sizeof(limit_str), "%u", limit);
+    }
+    mem_pool_set_lifo_reuse(pool, lifo);
+
+    workload(pool, arg, &result);
+
+    printf("%-8s %-10s %4s %-7s %10.1f %8u %8.3f %8u\n",
+           workload_name, policy_name, limit_str, lifo ? "lifo" : "default",
+           result.ns_per_op, result.failed, result.fragmentation, result.num_gaps);
+
+    mem_pool_close(pool);
+}
+
+static void run_workload(const char *workload_name, bench_workload_fn workload, const void *arg,
+                         size_t pool_size, unsigned lifo) {
+    run_one(workload_name, workload, arg, pool_size, FIRST_FIT, 0, lifo);
+    run_one(workload_name, workload, arg, pool_size, BEST_FIT, 0, lifo);
+    for (unsigned u = 0; u < sizeof(BENCH_GOOD_FIT_LIMITS) / sizeof(BENCH_GOOD_FIT_LIMITS[0]); ++u) {
+        run_one(workload_name, workload, arg, pool_size, GOOD_FIT, BENCH_GOOD_FIT_LIMITS[u], lifo);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned scenarios = argc > 1 && strcmp(argv[1], "scenarios") == 0;
+
+    if (argc > 1 && ! scenarios) {
+        fprintf(stderr, "usage: %s [scenarios]\n", argv[0]);
+        return 1;
+    }
+
+    if (mem_init() != ALLOC_OK) return 1;
+
+    printf("%-8s %-10s %4s %-7s %10s %8s %8s %8s\n",
+           "workload", "policy", "K", "reuse", "ns/op", "failed", "frag", "gaps");
+
+    if (scenarios) {
+        for (unsigned u = 0; u < sizeof(SCENARIO_TRACES) / sizeof(SCENARIO_TRACES[0]); ++u) {
+            char name[16];
+
+            snprintf(name, sizeof(name), "scen%02u", u);
+            run_workload(name, workload_scenario, SCENARIO_TRACES[u], SCENARIO_POOL_SIZE, 0);
+        }
+
+        return mem_free() == ALLOC_OK ? 0 : 1;
+    }
+
+    run_workload("stress", workload_stress, NULL, stress_pool_size(), 0);
+    run_workload("churn", workload_churn, NULL, CHURN_POOL_SIZE, 0);
+    run_workload("pingpong", workload_pingpong, NULL, PINGPONG_POOL_SIZE, 0);
+    run_workload("pingpong", workload_pingpong, NULL, PINGPONG_POOL_SIZE, 1);
+
+    return mem_free() == ALLOC_OK ? 0 : 1;
+}
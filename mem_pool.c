@@ -2,10 +2,23 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for sched_getcpu()
+#endif
+
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
 #include <string.h>
+#include <threads.h>
+#include <stdatomic.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h> // for madvise()
+#include <unistd.h> // for sysconf()
+#include <time.h> // for clock_gettime()
+#endif
 
 #include "mem_pool.h"
 
@@ -18,16 +31,63 @@ static const float      MEM_FILL_FACTOR                 = 0.75;
 static const unsigned   MEM_EXPAND_FACTOR               = 2;
 
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
-static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
+static const unsigned   MEM_POOL_STORE_BLOCKS_MAX       = 24;
 
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
 static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+static const unsigned   MEM_NODE_BLOCKS_MAX             = 32;
+static const float      MEM_NODE_HEAP_TRIM_FACTOR       = 0.25;
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+static const float      MEM_GAP_IX_TRIM_FACTOR          = 0.125;
+
+static const unsigned   MEM_QUICK_LIST_BUCKETS          = 32;
+
+static const unsigned   MEM_GOOD_FIT_SEARCH_LIMIT       = 8;
+
+static const unsigned   MEM_LIFO_SEARCH_LIMIT           = 16;
+
+static const size_t     MEM_CACHE_LINE                  = 64;
+static const unsigned   MEM_CACHE_COLORS                = 8;
+static const size_t     MEM_NO_FIT                      = (size_t) -1;
+
+static const unsigned   MEM_SIZE_CLASSES_PER_DOUBLING   = 8;
+
+static const unsigned   MEM_TCACHE_BINS                 = 32;
+static const size_t     MEM_TCACHE_GRANULE              = 16;
+static const unsigned   MEM_TCACHE_BATCH                = 8;
+static const unsigned   MEM_TCACHE_MAX                  = 32;
+static const unsigned   MEM_TCACHE_DEPOT_MAX            = 128;
+
+static const unsigned   MEM_SPIN_LIMIT                  = 100;
+
+static const size_t     MEM_ARENA_ALIGN                 = 16;
+static const size_t     MEM_ARENA_CAS_ZONE              = 4096;
+
+static const size_t     MEM_SLAB_ALIGN                  = 16;
+static const unsigned   MEM_SLAB_IN_USE                 = UINT32_MAX;
+
+static const unsigned   MEM_POOL_NO_NODES               = MEM_POOL_ARENA | MEM_POOL_SLAB;
+static const unsigned   MEM_POOL_LANE                   = 0x100; // internal, a lane's flag
+
+static const unsigned   MEM_MAINTENANCE_PERIOD_MS       = 100;
+static const float      MEM_MAINTENANCE_FILL_FACTOR     = 0.5;
+static const size_t     MEM_PURGE_MIN_GAP               = 256 * 1024;
+
+static const unsigned   MEM_CLOSE_THREADS_MAX           = 16;
+
+static const unsigned   MEM_SNAPSHOT_RETRIES            = 64;
+
+static const unsigned   MEM_AUTO_POLICY_PERIOD          = 64;
+static const float      MEM_AUTO_POLICY_SMOOTHING       = 0.125;
+static const float      MEM_AUTO_POLICY_MAX_SEARCH      = 16;
+static const float      MEM_AUTO_POLICY_MIN_SEARCH      = 4;
+static const float      MEM_AUTO_POLICY_MAX_FRAG        = 0.5;
+static const float      MEM_AUTO_POLICY_MIN_FRAG        = 0.1;
 
 
 
@@ -36,32 +96,154 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
-typedef struct _alloc {
-    char *mem;
-    size_t size;
-} alloc_t, *alloc_pt;
-
 typedef struct _node {
     alloc_t alloc_record;
     unsigned used;
     unsigned allocated;
+    unsigned quick; // freed, but parked on a quick list (not coalesced)
+    unsigned cached; // freed, but held by a thread cache (still allocated)
+    atomic_uint remote; // freed by another thread, waiting for the owner
+    unsigned deferred; // freed, waiting for the epoch's readers to leave
+    unsigned deferred_epoch; // the epoch it was freed in
     struct _node *next, *prev; // doubly-linked list for gap deletion
+    struct _node *quick_next; // next node on the same quick list (or tcache bin)
+    struct _node *size_next, *size_prev; // gaps in the same gap hash bucket
+    struct _node *gap_next, *gap_prev; // indexed gaps by address (GOOD_FIT)
+    struct _node *recent_next, *recent_prev; // indexed gaps, most recent first
+    struct _node *remote_next; // next block on the remote free stack
+    struct _node *deferred_next; // next block on the deferred free stack
 } node_t, *node_pt;
 
+typedef struct _node_block {
+    node_pt nodes;
+    unsigned capacity;
+} node_block_t, *node_block_pt;
+
 typedef struct _gap {
     size_t size;
     node_pt node;
 } gap_t, *gap_pt;
 
+typedef struct _quick_list {
+    size_t size;
+    node_pt head;
+} quick_list_t, *quick_list_pt;
+
 typedef struct _pool_mgr {
     pool_t pool;
     node_pt node_heap;
     unsigned total_nodes;
     unsigned used_nodes;
+    node_pt unused_nodes; // stack of unused nodes, linked through next
+    node_block_pt node_blocks; // node_heap is block 0, MEM_NODE_BLOCKS_MAX
+    atomic_uint num_node_blocks; // read without the lock (never moves)
     gap_pt gap_ix;
+    unsigned gap_ix_size;
     unsigned gap_ix_capacity;
+    node_pt *gap_hash; // gap size -> indexed gaps, gap_ix_capacity buckets
+    node_pt gap_list; // indexed gaps in address order, GOOD_FIT only
+    node_pt gap_rover; // where the next GOOD_FIT search starts
+    node_pt gap_recent; // the most recently indexed gap
+    node_pt top_node; // trailing gap, kept out of the gap index
+    quick_list_pt quick_lists; // NULL unless deferred coalescing is on
+    unsigned num_quick;
+    unsigned quick_threshold;
+    unsigned search_limit; // max candidate gaps examined by GOOD_FIT
+    unsigned lifo_reuse; // prefer the most recently freed gap
+    unsigned cache_align; // allocations start and end on cache lines
+    unsigned cache_coloring; // leading slack rotates over cache sets
+    unsigned cache_color; // slack (in cache lines) of the next allocation
+    alloc_size_class size_classes; // how request sizes are rounded
+    size_t size_step; // grid step, or smallest class if geometric
+    size_t min_split; // smaller remainders stay with the allocation
+    unsigned auto_policy; // switch between FIRST_FIT and BEST_FIT
+    unsigned auto_policy_allocs; // allocations since the last decision
+    float auto_policy_search; // average FIRST_FIT search length
+    atomic_uint tcache; // small sizes go through the thread caches
+    struct _tcache *tcaches; // all threads' caches of the pool, for stealing
+    atomic_int tcaches_lock; // a spinlock, for the list of caches
+    struct _tcache_bin *depot; // surplus cached blocks, MEM_TCACHE_BINS
+    atomic_int depot_lock; // a spinlock, for the depot
+    unsigned flags; // MEM_POOL_SHARED, MEM_POOL_SPIN, MEM_POOL_OWNED
+    mtx_t lock; // MEM_POOL_SHARED only
+    atomic_int spin_lock; // MEM_POOL_SPIN only
+    thrd_t owner; // MEM_POOL_OWNED only
+    _Atomic(node_pt) remote_frees; // blocks freed by other threads, MPSC
+    _Atomic(node_pt) deferred_frees; // blocks freed in an epoch, not yet safe
+    unsigned store_ix; // slot in the pool store
+    _Atomic(size_t) arena_offset; // MEM_POOL_ARENA only, next free byte
+    size_t object_size; // MEM_POOL_SLAB only, from here on
+    unsigned num_objects;
+    atomic_uint *slab_next; // 1 + next free object, or MEM_SLAB_IN_USE
+    _Atomic(uint64_t) slab_free; // free object stack: tag << 32 | 1 + object
+    atomic_uint slab_used; // objects handed out
+    struct _pool_mgr **lanes; // MEM_POOL_LANES only, in address order
+    unsigned num_lanes;
+    struct _pool_mgr *laned; // MEM_POOL_LANE only, the pool of the lane
+    size_t laned_alloc_size; // the lane's counters as added to its pool's
+    unsigned laned_num_allocs;
+    unsigned laned_num_gaps;
+    char *lane_end; // where the lane ended when the pool was opened
+    atomic_uint lane_joined; // has grown past it, into the next lane
+    size_t idle_alloc_size; // the pool as of the last maintenance pass
+    unsigned idle_num_allocs;
+    unsigned purged; // idle gaps given back to the OS since then
+    atomic_uint waiters; // blocked in mem_new_alloc_wait
+    _Atomic(size_t) wait_size; // the smallest size they wait for
+    atomic_uint free_gen; // bumped for every wakeup of the waiters
+    unsigned long lock_acquisitions; // MEM_POOL_SHARED only, under the lock
+    unsigned long lock_contended; // found the lock taken
+    unsigned long long lock_wait_ns; // total, of the contended ones
+    unsigned long long lock_max_hold_ns;
+    unsigned long long lock_acquired_ns; // when the holder got it
+    atomic_uint snapshot_seq; // odd while the lock is held (a seqlock)
+    atomic_uint snapshot_readers; // keep the node blocks from being freed
 } pool_mgr_t, *pool_mgr_pt;
 
+typedef struct _pool_slot {
+    atomic_uint version; // odd while the slot is changing (a seqlock)
+    _Atomic(pool_mgr_pt) pool_mgr; // NULL if free
+    _Atomic(uintptr_t) mem; // the pool's memory, for lookups
+    _Atomic(size_t) size;
+    atomic_uint next_free; // 1 + next slot on the free stack, 0 ends it
+} pool_slot_t, *pool_slot_pt;
+
+typedef struct _tcache_bin {
+    node_pt head; // linked through quick_next
+    unsigned count;
+} tcache_bin_t, *tcache_bin_pt;
+
+typedef struct _tcache {
+    pool_mgr_pt pool_mgr;
+    tcache_bin_pt bins; // one per size class, MEM_TCACHE_BINS
+    struct _tcache *next; // the thread's cache for another pool
+    struct _tcache *pool_next, *pool_prev; // other threads' caches of the pool
+    atomic_int registered; // on the pool's list (until the pool is closed)
+    atomic_int lock; // a spinlock, for the thread and whoever steals
+} tcache_t, *tcache_pt;
+
+typedef struct _epoch_reader {
+    atomic_uint epoch; // the epoch the thread entered
+    atomic_uint active; // inside an epoch
+    atomic_int in_use; // claimed by a thread (given up at thread exit)
+    unsigned depth; // nested enters, the thread's own
+    struct _epoch_reader *next; // all readers, never unlinked
+} epoch_reader_t, *epoch_reader_pt;
+
+typedef struct _close_job {
+    pool_pt *pools;
+    unsigned num_pools;
+    unsigned char *owned; // closed by the caller (once the workers are done)
+    atomic_uint next; // the next pool to close
+    atomic_uint failed; // pools left open
+} close_job_t, *close_job_pt;
+
+typedef struct _pool_group_mgr {
+    pool_group_t group;
+    pool_pt *shards; // by CPU
+    pool_pt *shards_by_mem; // sorted by pool memory address, for frees
+} pool_group_mgr_t, *pool_group_mgr_pt;
+
 
 
 /***************************/
@@ -69,9 +251,24 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+static _Atomic(pool_slot_pt) *pool_store = NULL; // blocks of slots, never move
+static atomic_uint pool_store_size = 0; // slots handed out so far, only grows
+static _Atomic(uint64_t) pool_store_free = 0; // free slot stack: tag << 32 | 1 + slot
+static tss_t tcache_key; // flushes a thread's caches when it exits
+static _Thread_local tcache_pt thread_tcache = NULL; // one per pool used
+static atomic_int tcache_registry_lock = 0; // a spinlock, keeps a closing pool and exiting threads apart
+static atomic_uint mem_epoch = 0; // the global epoch, only grows (and wraps)
+static _Atomic(epoch_reader_pt) epoch_readers = NULL; // a push-only list
+static tss_t epoch_key; // gives up a thread's reader record when it exits
+static unsigned maintenance_on = 0; // MEM_INIT_MAINTENANCE
+static thrd_t maintenance_thread;
+static mtx_t maintenance_lock; // held for a pass (thread or mem_maintain), and by pools being closed
+static cnd_t maintenance_wakeup; // signalled to stop
+static unsigned maintenance_stop = 0;
+static mtx_t alloc_wait_lock; // for the waiters of all pools
+static cnd_t alloc_wait_cond; // broadcast when a pool frees a gap they fit
+static atomic_uint group_threads = 0; // threads given a home shard so far
+static _Thread_local unsigned thread_shard = 0; // 1 + home shard, w/o a CPU id
 
 
 /********************************************/
@@ -79,15 +276,119 @@ static unsigned pool_store_capacity = 0;
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static pool_pt _mem_pool_open(size_t size, alloc_policy policy,
+                              unsigned flags, size_t object_size, char *mem);
+static pool_slot_pt _mem_pool_store_slot(unsigned ix, unsigned create);
+static alloc_status _mem_claim_pool_store_slot(unsigned *ix);
+static void _mem_release_pool_store_slot(unsigned ix);
+static void _mem_publish_pool_store_slot(pool_slot_pt slot, pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, float fill_factor);
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr, float fill_factor);
+static void _mem_trim_node_heap(pool_mgr_pt pool_mgr);
+static void _mem_trim_gap_ix(pool_mgr_pt pool_mgr);
+static void _mem_purge_gaps(pool_mgr_pt pool_mgr);
+static void _mem_maintain_pool(pool_mgr_pt pool_mgr);
+static void _mem_maintain_store();
+static int _mem_maintenance_thread(void *arg);
+static void _mem_unpublish_pool(pool_mgr_pt pool_mgr);
+static void _mem_wake_waiters(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_close_pools(pool_pt *pools, unsigned num_pools, unsigned num_threads);
+static int _mem_close_worker(void *job);
 static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                                        size_t size, node_pt node);
 static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                            size_t size, node_pt node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
-static alloc_status _mem_invalidate_gap_ix(pool_mgr_pt pool_mgr);
+static unsigned _mem_gap_ix_lower_bound(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_rehash_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity);
+static void _mem_add_to_gap_hash(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_remove_from_gap_hash(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_find_exact_gap(pool_mgr_pt pool_mgr, size_t size);
+static int _mem_is_indexed_gap(pool_mgr_pt pool_mgr, node_pt node);
+static int _mem_is_on_gap_list(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_add_to_gap_list(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_remove_from_gap_list(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_build_gap_list(pool_mgr_pt pool_mgr);
+static void _mem_add_to_recent_list(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_remove_from_recent_list(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_find_recent_gap(pool_mgr_pt pool_mgr, size_t size);
+static void _mem_switch_policy(pool_mgr_pt pool_mgr, alloc_policy policy);
+static float _mem_fragmentation(pool_mgr_pt pool_mgr);
+static void _mem_auto_policy(pool_mgr_pt pool_mgr, unsigned first_fit_ix);
+static alloc_status _mem_add_gap(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status _mem_remove_gap(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node);
+static int _mem_is_heap_node(pool_mgr_pt pool_mgr, node_pt node);
+static void * _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size, alloc_hint hint);
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_find_gap_by_address(pool_mgr_pt pool_mgr, size_t size, unsigned highest);
+static size_t _mem_request_size(pool_mgr_pt pool_mgr, size_t size);
+static size_t _mem_alloc_offset(pool_mgr_pt pool_mgr, node_pt gap_node,
+                                size_t size, size_t lead, unsigned from_high);
+static node_pt _mem_split_gap(pool_mgr_pt pool_mgr, node_pt gap_node,
+                              size_t offset, size_t size);
+static void _mem_insert_node_after(node_pt node, node_pt new_node);
+static alloc_status _mem_release_node(pool_mgr_pt pool_mgr, node_pt node);
+static unsigned _mem_hash_size(size_t size, unsigned num_buckets);
+static alloc_status _mem_push_quick_list(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_pop_quick_list(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, node_pt node);
+static tcache_pt _mem_get_tcache(pool_mgr_pt pool_mgr, unsigned create);
+static node_pt _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_tcache_flush(tcache_pt tcache, unsigned bin_ix, unsigned keep);
+static void _mem_tcache_release(pool_mgr_pt pool_mgr);
+static void _mem_tcache_destroy(void *tcache_list);
+static void _mem_tcache_register(tcache_pt tcache);
+static void _mem_tcache_unregister(tcache_pt tcache);
+static node_pt _mem_tcache_detach(tcache_bin_pt bin, unsigned keep, unsigned *count);
+static void _mem_tcache_give_back(pool_mgr_pt pool_mgr, node_pt chain);
+static node_pt _mem_depot_take(pool_mgr_pt pool_mgr, unsigned bin_ix, unsigned *count);
+static node_pt _mem_depot_put(pool_mgr_pt pool_mgr, unsigned bin_ix,
+                              node_pt chain, unsigned count);
+static void _mem_depot_release(pool_mgr_pt pool_mgr);
+static node_pt _mem_tcache_steal(tcache_pt tcache, unsigned bin_ix, unsigned *count);
+static void _mem_spin_lock(atomic_int *lock);
+static int _mem_spin_trylock(atomic_int *lock);
+static void _mem_spin_unlock(atomic_int *lock);
+static unsigned long long _mem_now_ns();
+static void _mem_lock(pool_mgr_pt pool_mgr);
+static void _mem_unlock(pool_mgr_pt pool_mgr);
+static void * _mem_new_alloc_near(pool_mgr_pt pool_mgr, size_t size, node_pt near_node);
+static alloc_status _mem_set_quick_lists(pool_mgr_pt pool_mgr, unsigned threshold);
+static alloc_status _mem_consolidate(pool_mgr_pt pool_mgr);
+static int _mem_is_owner(pool_mgr_pt pool_mgr);
+static void _mem_push_remote_free(pool_mgr_pt pool_mgr, node_pt node);
+static void _mem_drain_remote_frees(pool_mgr_pt pool_mgr);
+static epoch_reader_pt _mem_get_epoch_reader(unsigned create);
+static void _mem_epoch_release(void *reader);
+static unsigned _mem_epoch_try_advance();
+static void _mem_push_deferred_frees(pool_mgr_pt pool_mgr, node_pt head, node_pt tail);
+static void _mem_reclaim_deferred(pool_mgr_pt pool_mgr);
+static int _mem_compare_pool_mem(const void *a, const void *b);
+static unsigned _mem_home_shard(unsigned num_shards);
+static pool_pt _mem_group_find_shard(pool_group_mgr_pt group_mgr, alloc_pt alloc);
+static pool_mgr_pt _mem_find_lane(pool_mgr_pt pool_mgr, node_pt node);
+static void * _mem_lanes_new_alloc(pool_mgr_pt pool_mgr, size_t size, alloc_hint hint);
+static alloc_status _mem_lanes_set(pool_mgr_pt pool_mgr,
+                                   alloc_status (*setter)(pool_pt, unsigned), unsigned value);
+static void * _mem_lanes_join(pool_mgr_pt low, pool_mgr_pt high, size_t size, alloc_hint hint);
+static void _mem_lanes_give_back(pool_mgr_pt pool_mgr, pool_mgr_pt lane);
+static void _mem_lanes_unjoin(pool_mgr_pt low, pool_mgr_pt high);
+static void _mem_lane_publish(pool_mgr_pt lane);
+static void _mem_inspect_lanes(pool_mgr_pt pool_mgr,
+                               pool_segment_pt *segments, unsigned *num_segments);
+static void _mem_store_node(node_pt *field, node_pt value);
+static void _mem_store_size(size_t *field, size_t value);
+static void _mem_store_unsigned(unsigned *field, unsigned value);
+static node_pt _mem_load_node(node_pt *field);
+static size_t _mem_load_size(size_t *field);
+static unsigned _mem_load_unsigned(unsigned *field);
+static unsigned _mem_read_segments(pool_mgr_pt pool_mgr,
+                                   pool_segment_pt segments, unsigned capacity);
+static alloc_status _mem_snapshot_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                           unsigned capacity, unsigned *num_segments);
 
 
 
@@ -97,64 +398,303 @@ static alloc_status _mem_invalidate_gap_ix(pool_mgr_pt pool_mgr);
 /*                                      */
 /****************************************/
 alloc_status mem_init() {
+    return mem_init_ex(0);
+}
+
+alloc_status mem_init_ex(unsigned flags) {
     // ensure that it's called only once until mem_free
-    if(pool_store_capacity > 0)
+    if(pool_store != NULL)
     {
         return ALLOC_CALLED_AGAIN;
     }
 
-    // allocate the pool store with initial capacity
+    // allocate the pool store's block list, blocks of slots come on demand
     // note: holds pointers only, other functions to allocate/deallocate
-    pool_store = (pool_mgr_pt*) calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_t));
+    pool_store = (_Atomic(pool_slot_pt)*) calloc(MEM_POOL_STORE_BLOCKS_MAX, sizeof(pool_slot_pt));
     if(pool_store == NULL)
     {
         return ALLOC_FAIL;
     }
-    pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+    atomic_init(&pool_store_size, 0);
+    atomic_init(&pool_store_free, 0);
+
+    // register the cleanup of the thread caches at thread exit
+    if(tss_create(&tcache_key, _mem_tcache_destroy) != thrd_success)
+    {
+        free(pool_store);
+        pool_store = NULL;
+        return ALLOC_FAIL;
+    }
+
+    // and the release of the epoch reader records
+    if(tss_create(&epoch_key, _mem_epoch_release) != thrd_success)
+    {
+        tss_delete(tcache_key);
+        free(pool_store);
+        pool_store = NULL;
+        return ALLOC_FAIL;
+    }
+
+    // the waiters of all pools share a condition variable
+    if(mtx_init(&alloc_wait_lock, mtx_plain) != thrd_success)
+    {
+        tss_delete(epoch_key);
+        tss_delete(tcache_key);
+        free(pool_store);
+        pool_store = NULL;
+        return ALLOC_FAIL;
+    }
+    if(cnd_init(&alloc_wait_cond) != thrd_success)
+    {
+        mtx_destroy(&alloc_wait_lock);
+        tss_delete(epoch_key);
+        tss_delete(tcache_key);
+        free(pool_store);
+        pool_store = NULL;
+        return ALLOC_FAIL;
+    }
+
+    // maintenance passes (on the thread, or mem_maintain) and pools
+    // being closed keep out of each other's way
+    if(mtx_init(&maintenance_lock, mtx_plain) != thrd_success)
+    {
+        cnd_destroy(&alloc_wait_cond);
+        mtx_destroy(&alloc_wait_lock);
+        tss_delete(epoch_key);
+        tss_delete(tcache_key);
+        free(pool_store);
+        pool_store = NULL;
+        return ALLOC_FAIL;
+    }
+
+    // start the maintenance thread, if asked to
+    maintenance_on = 0;
+    if(flags & MEM_INIT_MAINTENANCE)
+    {
+        maintenance_stop = 0;
+        if(cnd_init(&maintenance_wakeup) != thrd_success)
+        {
+            mem_free();
+            return ALLOC_FAIL;
+        }
+        if(thrd_create(&maintenance_thread, _mem_maintenance_thread, NULL) != thrd_success)
+        {
+            cnd_destroy(&maintenance_wakeup);
+            mem_free();
+            return ALLOC_FAIL;
+        }
+        maintenance_on = 1;
+    }
 
     return ALLOC_OK;
 }
 
 alloc_status mem_free() {
     // ensure that it's called only once for each mem_init
-    if(pool_store_capacity == 0)
+    if(pool_store == NULL)
     {
         return ALLOC_CALLED_AGAIN;
     }
 
     // make sure all pool managers have been deallocated
+    unsigned size = atomic_load(&pool_store_size);
+    for(unsigned i = 0; i < size; i++)
+    {
+        pool_slot_pt slot = _mem_pool_store_slot(i, 0);
+        if(slot != NULL && atomic_load(&slot->pool_mgr) != NULL)
+        {
+            return ALLOC_NOT_FREED;
+        }
+    }
+
+    // stop the maintenance thread
+    if(maintenance_on)
+    {
+        mtx_lock(&maintenance_lock);
+        maintenance_stop = 1;
+        cnd_signal(&maintenance_wakeup);
+        mtx_unlock(&maintenance_lock);
+
+        thrd_join(maintenance_thread, NULL);
+        cnd_destroy(&maintenance_wakeup);
+        maintenance_on = 0;
+    }
+    mtx_destroy(&maintenance_lock);
+
+    cnd_destroy(&alloc_wait_cond);
+    mtx_destroy(&alloc_wait_lock);
+
+    // drop this thread's (empty) caches, other threads drop theirs at exit
+    mem_tcache_flush();
+    tss_delete(tcache_key);
+
+    // drop the epoch reader records (no thread may be inside an epoch)
+    tss_delete(epoch_key);
+    epoch_reader_pt reader = atomic_exchange(&epoch_readers, NULL);
+    while(reader != NULL)
+    {
+        epoch_reader_pt next = reader->next;
+        free(reader);
+        reader = next;
+    }
 
-    // can free the pool store array
-    free(*pool_store);
+    // can free the pool store blocks and their list
+    for(unsigned i = 0; i < MEM_POOL_STORE_BLOCKS_MAX; i++)
+    {
+        free(atomic_load(&pool_store[i]));
+    }
+    free(pool_store);
 
     // update static variables
-    *pool_store = NULL; // an array of pointers, only expand
-    pool_store_size = 0;
-    pool_store_capacity = 0;
+    pool_store = NULL;
+    atomic_store(&pool_store_size, 0);
+    atomic_store(&pool_store_free, 0);
 
     return ALLOC_OK;
 }
 
+// note: closes the pools still open (not groups, close those first) on
+//       up to num_threads threads, then frees the store as mem_free does
+alloc_status mem_free_parallel(unsigned num_threads) {
+    // ensure that it's called only once for each mem_init
+    if(pool_store == NULL)
+    {
+        return ALLOC_CALLED_AGAIN;
+    }
+
+    // collect the open pools
+    unsigned size = atomic_load(&pool_store_size);
+    pool_pt *pools = (pool_pt*) calloc(size ? size : 1, sizeof(pool_pt));
+    if(pools == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+    unsigned num_pools = 0;
+    for(unsigned i = 0; i < size; i++)
+    {
+        pool_slot_pt slot = _mem_pool_store_slot(i, 0);
+        pool_mgr_pt pool_mgr = slot != NULL ? atomic_load(&slot->pool_mgr) : NULL;
+        if(pool_mgr != NULL)
+        {
+            pools[num_pools++] = (pool_pt)pool_mgr;
+        }
+    }
+
+    alloc_status result = _mem_close_pools(pools, num_pools, num_threads);
+    free(pools);
+    if(result != ALLOC_OK)
+    {
+        return result;
+    }
+
+    return mem_free();
+}
+
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return mem_pool_open_ex(size, policy, 0);
+}
+
+pool_pt mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags) {
+    // slabs and laned pools have their own open calls
+    if(flags & (MEM_POOL_SLAB | MEM_POOL_LANES | MEM_POOL_LANE))
+    {
+        return NULL;
+    }
+
+    return _mem_pool_open(size, policy, flags, 0, NULL);
+}
+
+pool_pt mem_pool_open_slab(size_t size, size_t object_size) {
+    if(object_size == 0 || object_size > size)
+    {
+        return NULL;
+    }
+
+    return _mem_pool_open(size, FIRST_FIT, MEM_POOL_SLAB, object_size, NULL);
+}
+
+// note: each lane is a shared pool over its own address range of the pool
+//       memory, the lanes' boundaries move when an allocation only fits
+//       in the trailing gap of one lane and the leading gap of the next,
+//       and back once it's freed; a larger allocation fails (it can't
+//       be much over two lanes)
+// note: there is no lock over all the lanes, a lane adds the changes to
+//       its counters to the pool's each time its lock is let go
+pool_pt mem_pool_open_lanes(size_t size, alloc_policy policy, unsigned num_lanes) {
+    // every lane gets whole cache lines
+    size_t lane_size = size / MEM_CACHE_LINE / (num_lanes ? num_lanes : 1) * MEM_CACHE_LINE;
+    if(num_lanes == 0 || lane_size == 0)
+    {
+        return NULL;
+    }
+
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)_mem_pool_open(size, policy, MEM_POOL_LANES, 0, NULL);
+    if(pool_mgr == NULL)
+    {
+        return NULL;
+    }
+
+    pool_mgr->lanes = (pool_mgr_pt*) calloc(num_lanes, sizeof(pool_mgr_pt));
+    if(pool_mgr->lanes == NULL)
+    {
+        mem_pool_close((pool_pt)pool_mgr);
+        return NULL;
+    }
+
+    // the last lane takes what's left over
+    pool_mgr->pool.num_gaps = 0;
+    for(unsigned i = 0; i < num_lanes; i++)
+    {
+        pool_mgr->lanes[i] = (pool_mgr_pt)_mem_pool_open(
+                i + 1 < num_lanes ? lane_size : size - i * lane_size, policy,
+                MEM_POOL_SHARED | MEM_POOL_LANE, 0, pool_mgr->pool.mem + i * lane_size);
+        if(pool_mgr->lanes[i] == NULL)
+        {
+            mem_pool_close((pool_pt)pool_mgr);
+            return NULL;
+        }
+        pool_mgr->lanes[i]->laned = pool_mgr;
+        pool_mgr->lanes[i]->lane_end = pool_mgr->lanes[i]->pool.mem
+                                       + pool_mgr->lanes[i]->pool.total_size;
+        atomic_init(&pool_mgr->lanes[i]->lane_joined, 0);
+        _mem_lane_publish(pool_mgr->lanes[i]);
+        pool_mgr->num_lanes = i + 1;
+    }
+
+    return (pool_pt)pool_mgr;
+}
+
+static pool_pt _mem_pool_open(size_t size, alloc_policy policy,
+                              unsigned flags, size_t object_size, char *mem) {
     // make sure there the pool store is allocated
-    assert(pool_store_capacity > 0);
+    assert(pool_store != NULL);
 
-    // expand the pool store, if necessary
-    if(pool_store_size == pool_store_capacity)
+    // a spinlock is a kind of shared pool
+    if(flags & MEM_POOL_SPIN)
     {
-        _mem_resize_pool_store();
+        flags |= MEM_POOL_SHARED;
+    }
+
+    // an owned pool has no lock to share
+    if((flags & MEM_POOL_OWNED) && (flags & MEM_POOL_SHARED))
+    {
+        return NULL;
     }
 
     // allocate a new mem pool mgr
-    pool_mgr_pt new_pool_mgr = (pool_mgr_pt) malloc(sizeof(pool_mgr_t));
+    pool_mgr_pt new_pool_mgr = (pool_mgr_pt) calloc(1, sizeof(pool_mgr_t));
     // check success, on error return null
     if(new_pool_mgr == NULL)
     {
       return NULL;
     }
 
-    // allocate a new memory pool
-    new_pool_mgr->pool.mem = malloc(size);
+    // allocate a new memory pool, starting on a cache line, unless a
+    // laned pool hands its lane the memory
+    // note: aligned_alloc wants a multiple of the alignment
+    char *own_mem = mem != NULL ? NULL : aligned_alloc(MEM_CACHE_LINE,
+            (size + MEM_CACHE_LINE - 1) / MEM_CACHE_LINE * MEM_CACHE_LINE);
+    new_pool_mgr->pool.mem = mem != NULL ? mem : own_mem;
     // check success, on error deallocate mgr and return null
     if(new_pool_mgr->pool.mem == NULL)
     {
@@ -167,43 +707,161 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     // check success, on error deallocate mgr/pool and return null
     if(new_pool_mgr->node_heap == NULL)
     {
-        free(new_pool_mgr->pool.mem);
+        free(own_mem);
+        free(new_pool_mgr);
+        return NULL;
+    }
+
+    // allocate the node block list, the node heap is its first block
+    new_pool_mgr->node_blocks = (node_block_pt) calloc(MEM_NODE_BLOCKS_MAX, sizeof(node_block_t));
+    // check success, on error deallocate mgr/pool/heap and return null
+    if(new_pool_mgr->node_blocks == NULL)
+    {
+        free(new_pool_mgr->node_heap);
+        free(own_mem);
         free(new_pool_mgr);
         return NULL;
     }
 
     // allocate a new gap index
     new_pool_mgr->gap_ix = (gap_pt) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
-    // check success, on error deallocate mgr/pool/heap and return null
+    // check success, on error deallocate mgr/pool/heap/blocks and return null
     if(new_pool_mgr->gap_ix == NULL)
     {
+        free(new_pool_mgr->node_blocks);
+        free(new_pool_mgr->node_heap);
+        free(own_mem);
+        free(new_pool_mgr);
+        return NULL;
+    }
+
+    // allocate the exact-fit hash next to the gap index
+    new_pool_mgr->gap_hash = (node_pt*) calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(node_pt));
+    // check success, on error deallocate mgr/pool/heap/blocks/index and return null
+    if(new_pool_mgr->gap_hash == NULL)
+    {
+        free(new_pool_mgr->gap_ix);
+        free(new_pool_mgr->node_blocks);
         free(new_pool_mgr->node_heap);
-        free(new_pool_mgr->pool.mem);
+        free(own_mem);
         free(new_pool_mgr);
         return NULL;
     }
 
     // assign all the pointers and update meta data:
 
-    //   initialize top node of node heap
+    //   initialize the node heap and its unused node stack
+    //   (the top node is never on the stack)
     new_pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-    //  new_pool_mgr->used_nodes = 1;
+    new_pool_mgr->node_blocks[0].nodes = new_pool_mgr->node_heap;
+    new_pool_mgr->node_blocks[0].capacity = MEM_NODE_HEAP_INIT_CAPACITY;
+    atomic_init(&new_pool_mgr->num_node_blocks, 1);
+    for(unsigned i = MEM_NODE_HEAP_INIT_CAPACITY - 1; i > 0; i--)
+    {
+        _mem_put_unused_node(new_pool_mgr, &new_pool_mgr->node_heap[i]);
+    }
+
+    //   initialize top node of node heap
+    new_pool_mgr->used_nodes = 1;
     new_pool_mgr->node_heap->alloc_record.mem = new_pool_mgr->pool.mem;
     new_pool_mgr->node_heap->alloc_record.size = size;
     new_pool_mgr->node_heap->used = 1;
     new_pool_mgr->node_heap->allocated = 0;
-    //   initialize top node of gap index
-    new_pool_mgr->gap_ix_capacity =  MEM_GAP_IX_INIT_CAPACITY;
-    _mem_add_to_gap_ix(new_pool_mgr, size, new_pool_mgr->node_heap);
 
     //   initialize pool mgr
     new_pool_mgr->pool.policy = policy;
     new_pool_mgr->pool.total_size = size;
     new_pool_mgr->pool.alloc_size = 0;
     new_pool_mgr->pool.num_allocs = 0;
+    new_pool_mgr->pool.num_gaps = 0;
+    new_pool_mgr->search_limit = MEM_GOOD_FIT_SEARCH_LIMIT;
+
+    //   the whole pool starts out as the top chunk, the gap index is empty
+    new_pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    _mem_add_gap(new_pool_mgr, new_pool_mgr->node_heap);
+
+    //   initialize the lock of a shared pool
+    new_pool_mgr->flags = flags;
+    atomic_init(&new_pool_mgr->tcache, 0);
+    atomic_init(&new_pool_mgr->depot_lock, 0);
+    atomic_init(&new_pool_mgr->tcaches_lock, 0);
+    atomic_init(&new_pool_mgr->spin_lock, 0);
+    atomic_init(&new_pool_mgr->remote_frees, NULL);
+    atomic_init(&new_pool_mgr->deferred_frees, NULL);
+    atomic_init(&new_pool_mgr->arena_offset, 0);
+    atomic_init(&new_pool_mgr->waiters, 0);
+    atomic_init(&new_pool_mgr->wait_size, (size_t) -1);
+    atomic_init(&new_pool_mgr->free_gen, 0);
+    atomic_init(&new_pool_mgr->snapshot_seq, 0);
+    atomic_init(&new_pool_mgr->snapshot_readers, 0);
+    if(flags & MEM_POOL_OWNED)
+    {
+        new_pool_mgr->owner = thrd_current();
+    }
+    if((flags & MEM_POOL_SHARED) && ! (flags & MEM_POOL_SPIN)
+       && mtx_init(&new_pool_mgr->lock, mtx_plain) != thrd_success)
+    {
+        free(new_pool_mgr->gap_hash);
+        free(new_pool_mgr->gap_ix);
+        free(new_pool_mgr->node_blocks);
+        free(new_pool_mgr->node_heap);
+        free(own_mem);
+        free(new_pool_mgr);
+        return NULL;
+    }
+
+    //   put all the objects of a slab on its free stack, in address order
+    atomic_init(&new_pool_mgr->slab_free, 0);
+    atomic_init(&new_pool_mgr->slab_used, 0);
+    if(flags & MEM_POOL_SLAB)
+    {
+        object_size = (object_size + MEM_SLAB_ALIGN - 1) / MEM_SLAB_ALIGN * MEM_SLAB_ALIGN;
+        new_pool_mgr->object_size = object_size;
+        new_pool_mgr->num_objects = (unsigned) (size / object_size);
+        new_pool_mgr->slab_next = (atomic_uint*) calloc(new_pool_mgr->num_objects + 1,
+                                                        sizeof(atomic_uint));
+        if(new_pool_mgr->num_objects == 0 || size / object_size >= MEM_SLAB_IN_USE
+           || new_pool_mgr->slab_next == NULL)
+        {
+            free(new_pool_mgr->slab_next);
+            free(new_pool_mgr->gap_hash);
+            free(new_pool_mgr->gap_ix);
+            free(new_pool_mgr->node_blocks);
+            free(new_pool_mgr->node_heap);
+            free(own_mem);
+            free(new_pool_mgr);
+            return NULL;
+        }
+        for(unsigned i = 0; i < new_pool_mgr->num_objects; i++)
+        {
+            atomic_init(&new_pool_mgr->slab_next[i],
+                        i + 1 < new_pool_mgr->num_objects ? i + 2 : 0);
+        }
+        atomic_init(&new_pool_mgr->slab_free, 1);
+    }
 
-    //   link pool mgr to pool store
-    pool_store[pool_store_size++] = new_pool_mgr;
+    //   link pool mgr to a free slot of the pool store (not a lane)
+    if(! (flags & MEM_POOL_LANE)
+       && _mem_claim_pool_store_slot(&new_pool_mgr->store_ix) != ALLOC_OK)
+    {
+        if((flags & MEM_POOL_SHARED) && ! (flags & MEM_POOL_SPIN))
+        {
+            mtx_destroy(&new_pool_mgr->lock);
+        }
+        free(new_pool_mgr->slab_next);
+        free(new_pool_mgr->gap_hash);
+        free(new_pool_mgr->gap_ix);
+        free(new_pool_mgr->node_blocks);
+        free(new_pool_mgr->node_heap);
+        free(own_mem);
+        free(new_pool_mgr);
+        return NULL;
+    }
+    if(! (flags & MEM_POOL_LANE))
+    {
+        _mem_publish_pool_store_slot(_mem_pool_store_slot(new_pool_mgr->store_ix, 0),
+                                     new_pool_mgr);
+    }
 
     // return the address of the mgr, cast to (pool_pt)
     return (pool_pt)new_pool_mgr;
@@ -212,525 +870,4028 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
 alloc_status mem_pool_close(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
-    // check if this pool is allocated
-    // check if pool has only one gap
-    // check if it has zero allocations
-    if(pool->mem != NULL && pool->num_gaps == 1 && pool->num_allocs != 0)
+
+    // only the owner closes an owned pool, taking in the remote frees
+    if(! _mem_is_owner(pool_mgr))
     {
         return ALLOC_NOT_FREED;
     }
-        // free memory pool
-        free(pool->mem);
-
-        // free node heap
-        free(pool_mgr->node_heap);
+    _mem_drain_remote_frees(pool_mgr);
 
-        // free gap index
-        free(pool_mgr->gap_ix);
+    // blocks freed deferred count as allocations until their readers leave
+    _mem_reclaim_deferred(pool_mgr);
 
-    // find mgr in pool store and set to null
-    for(int i = 0; i < pool_store_capacity; i++)
+    // a laned pool checks that all of its lanes are empty before closing any
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
     {
-        if (pool_store[i] == pool_mgr)
+        pool_mgr_pt lane = pool_mgr->lanes[i];
+
+        _mem_reclaim_deferred(lane);
+        _mem_tcache_release(lane);
+        _mem_lock(lane);
+        unsigned num_allocs = lane->pool.num_allocs;
+        _mem_unlock(lane);
+        if(num_allocs != 0)
         {
-            pool_store[i] = NULL;
+            return ALLOC_NOT_FREED;
         }
     }
-    // note: don't decrement pool_store_size, because it only grows
-    // free mgr
-    free(pool);
-
-    return ALLOC_OK;
-}
+    unsigned laned = pool_mgr->num_lanes > 0;
+    if(laned)
+    {
+        _mem_unpublish_pool(pool_mgr);
+    }
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+    {
+        mem_pool_close((pool_pt)pool_mgr->lanes[i]);
+    }
+    free(pool_mgr->lanes);
+    pool_mgr->lanes = NULL;
+    pool_mgr->num_lanes = 0;
 
-void * mem_new_alloc(pool_pt pool, size_t size) {
-    // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
-    // Variable for remaining gap size
-    size_t rem_gap_size = 0;
+    // give back the blocks held by this thread's cache and the depot
+    _mem_tcache_release(pool_mgr);
 
-    // check if any gaps, return null if none
-    if(pool->num_gaps == 0)
+    // check if this pool is allocated
+    // check if it has zero allocations
+    // note: blocks parked on the quick lists are not allocations, those
+    //       held by thread caches are (other threads have to exit or
+    //       call mem_tcache_flush first)
+    _mem_lock(pool_mgr);
+    if(pool->mem == NULL || pool->num_allocs != 0
+       || atomic_load(&pool_mgr->slab_used) != 0)
     {
-        return NULL;
+        _mem_unlock(pool_mgr);
+        return ALLOC_NOT_FREED;
+    }
+    _mem_unlock(pool_mgr);
+    if(! laned)
+    {
+        _mem_unpublish_pool(pool_mgr);
     }
 
-    // expand heap node, if necessary, quit on error
-    alloc_status result = _mem_resize_node_heap(pool_mgr);
-    if(result != ALLOC_OK)
+    // free memory pool (a lane's belongs to its laned pool)
+    if(! (pool_mgr->flags & MEM_POOL_LANE))
     {
-        return NULL;
+        free(pool->mem);
     }
 
-    // check used nodes fewer than total nodes, quit on error
-    if(pool_mgr->used_nodes > pool_mgr->total_nodes)
+    // free node heap (all of its blocks)
+    for(unsigned i = 0; i < pool_mgr->num_node_blocks; i++)
     {
-        return NULL;
+        free(pool_mgr->node_blocks[i].nodes);
     }
+    free(pool_mgr->node_blocks);
 
-    // get a node for allocation:
-    node_pt alloc_node = pool_mgr->node_heap;
+    // free gap index and its hash
+    free(pool_mgr->gap_ix);
+    free(pool_mgr->gap_hash);
 
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if(pool->policy == 0)
+    // free quick lists
+    free(pool_mgr->quick_lists);
+
+    // free the depot, and forget the other threads' (empty) caches
+    free(pool_mgr->depot);
+    _mem_spin_lock(&tcache_registry_lock);
+    _mem_spin_lock(&pool_mgr->tcaches_lock);
+    for(tcache_pt tcache = pool_mgr->tcaches; tcache != NULL; tcache = tcache->pool_next)
     {
-        // While we haven't found the node we need
-        while(alloc_node->allocated != 0 || alloc_node->alloc_record.size < size)
-        {
-            // Set to next node
-            alloc_node = alloc_node->next;
-            //if NULL exit
-            if(alloc_node == NULL)
-            {
-                return NULL;
-            }
-        }
+        atomic_store(&tcache->registered, 0);
     }
+    pool_mgr->tcaches = NULL;
+    _mem_spin_unlock(&pool_mgr->tcaches_lock);
+    _mem_spin_unlock(&tcache_registry_lock);
+
+    // free the slab's free stack links
+    free(pool_mgr->slab_next);
 
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    if(pool->policy == 1)
+    // free the lock
+    if((pool_mgr->flags & MEM_POOL_SHARED) && ! (pool_mgr->flags & MEM_POOL_SPIN))
     {
-        int i = 0;
-        // check if node found
-        while(pool_mgr->gap_ix[i].node->alloc_record.size < size)
-        {
-            if(pool_mgr->gap_ix[i + 1].node == NULL)
-            {
-                return NULL;
-            }
-            i++;
-        }
+        mtx_destroy(&pool_mgr->lock);
+    }
 
-        alloc_node = pool_mgr->gap_ix[i].node;
+    // put the mgr's (cleared) slot in the pool store up for reuse
+    // note: don't decrement pool_store_size, because it only grows
+    if(! (pool_mgr->flags & MEM_POOL_LANE))
+    {
+        _mem_release_pool_store_slot(pool_mgr->store_ix);
     }
-    // update metadata (num_allocs, alloc_size)
-    pool->num_allocs += 1;
-    pool->alloc_size += size;
+    // free mgr
+    free(pool_mgr);
 
-    // calculate the size of the remaining gap, if any
+    return ALLOC_OK;
+}
+
+// note: the pools that can't be closed (still allocated, or owned by
+//       another thread) are left open, and the result is ALLOC_NOT_FREED
+alloc_status mem_pool_close_many(pool_pt pools[], unsigned num_pools) {
+    unsigned num_threads = MEM_CLOSE_THREADS_MAX;
 
-    rem_gap_size = alloc_node->alloc_record.size - size;
+#ifdef __linux__
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cpus > 0 && (unsigned long) num_cpus < num_threads)
+    {
+        num_threads = (unsigned) num_cpus;
+    }
+#endif
 
+    return _mem_close_pools(pools, num_pools, num_threads);
+}
 
-    // remove node from gap index
-    _mem_remove_from_gap_ix(pool_mgr, alloc_node->alloc_record.size , alloc_node);
+// note: lock-free, a pool found may be closed by another thread at any
+//       time, it's up to the caller to know that it isn't
+pool_pt mem_pool_find(const void *mem) {
+    // make sure there the pool store is allocated
+    assert(pool_store != NULL);
 
-    // convert gap_node to an allocation node of given size
-    alloc_node->allocated = 1;
-    alloc_node->alloc_record.size = size;
-      
-    // adjust node heap:
-    if(rem_gap_size)
+    unsigned size = atomic_load_explicit(&pool_store_size, memory_order_acquire);
+    for(unsigned i = 0; i < size; i++)
     {
-        //   if remaining gap, need a new node
-        node_pt new_node = NULL;
-
-        int i = 0;
-        while(pool_mgr->node_heap[i].used != 0)
+        pool_slot_pt slot = _mem_pool_store_slot(i, 0);
+        if(slot == NULL)
         {
-            i++;
+            continue;
         }
 
-        //   make sure one was found
-        if(&pool_mgr->node_heap[i] == NULL)
+        // read the slot again if it changed under us
+        unsigned version;
+        pool_mgr_pt pool_mgr;
+        uintptr_t slot_mem;
+        size_t slot_size;
+        do
         {
-            return NULL;
+            do
+            {
+                version = atomic_load_explicit(&slot->version, memory_order_acquire);
+            } while(version & 1);
+            pool_mgr = atomic_load_explicit(&slot->pool_mgr, memory_order_relaxed);
+            slot_mem = atomic_load_explicit(&slot->mem, memory_order_relaxed);
+            slot_size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+        } while(atomic_load_explicit(&slot->version, memory_order_relaxed) != version);
+
+        if(pool_mgr != NULL
+           && (uintptr_t) mem >= slot_mem && (uintptr_t) mem < slot_mem + slot_size)
+        {
+            return (pool_pt)pool_mgr;
         }
-        // Set it to new node
-        new_node = &pool_mgr->node_heap[i];
-        //   initialize it to a gap node
-        new_node->allocated = 0;
-        new_node->used = 1;
-        new_node->alloc_record.size = rem_gap_size;
-        new_node->alloc_record.mem = alloc_node->alloc_record.mem + size;
+    }
 
+    return NULL;
+}
 
-	//   update linked list (new node right after the node for allocation)
-	if(alloc_node->next){
-	  new_node->next = alloc_node->next;
-	  alloc_node->next->prev = new_node;
-	}
-	alloc_node->next = new_node;
-        new_node->prev = alloc_node;
+void * mem_new_alloc(pool_pt pool, size_t size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-        //   add to gap index
-        alloc_status result = _mem_add_to_gap_ix(pool_mgr, rem_gap_size, new_node);
-        //   check if successful
-        if (result != ALLOC_OK)
-        {
-            return NULL;
-        }
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_new_alloc(pool_mgr, size, MEM_HINT_NONE);
     }
 
-    //   update metadata (used_nodes)
-    pool_mgr->used_nodes += 1;
+    // only the owner allocates from an owned pool, arenas and slabs have
+    // their own allocation calls
+    if(! _mem_is_owner(pool_mgr) || (pool_mgr->flags & MEM_POOL_NO_NODES))
+    {
+        return NULL;
+    }
+    _mem_drain_remote_frees(pool_mgr);
+    _mem_reclaim_deferred(pool_mgr);
 
-    // return allocation record by casting the node to (alloc_pt)
-    return (alloc_pt)alloc_node;
+    // small sizes come from the thread cache, if on
+    if(atomic_load_explicit(&pool_mgr->tcache, memory_order_relaxed)
+       && size > 0 && size <= MEM_TCACHE_BINS * MEM_TCACHE_GRANULE)
+    {
+        return (alloc_pt)_mem_tcache_alloc(pool_mgr, size);
+    }
+
+    _mem_lock(pool_mgr);
+    void * alloc = _mem_new_alloc(pool_mgr, size, MEM_HINT_NONE);
+    _mem_unlock(pool_mgr);
+
+    return alloc;
 }
 
-alloc_status mem_del_alloc(pool_pt pool, void * alloc) {
+void * mem_new_alloc_hint(pool_pt pool, size_t size, alloc_hint hint) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
 
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt node = (node_pt)alloc;
+    if(hint != MEM_HINT_NONE && hint != MEM_HINT_SHORT && hint != MEM_HINT_LONG)
+    {
+        return NULL;
+    }
 
-    // find the node in the node heap
-    // this is node-to-delete
-    int i = 0;
-    while(&pool_mgr->node_heap[i] != node)
+    if(pool_mgr->lanes != NULL)
     {
-        i++;
+        return _mem_lanes_new_alloc(pool_mgr, size, hint);
     }
-    // make sure it's found
-    if(&pool_mgr->node_heap[i] == NULL)
+
+    if(! _mem_is_owner(pool_mgr) || (pool_mgr->flags & MEM_POOL_NO_NODES))
     {
-        return ALLOC_NOT_FREED;
+        return NULL;
     }
+    _mem_drain_remote_frees(pool_mgr);
+    _mem_reclaim_deferred(pool_mgr);
 
-    // convert to gap node
-    node->allocated = 0;
+    _mem_lock(pool_mgr);
+    void * alloc = _mem_new_alloc(pool_mgr, size, hint);
+    _mem_unlock(pool_mgr);
+
+    return alloc;
+}
+
+void * mem_new_alloc_near(pool_pt pool, size_t size, void *neighbor) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // get node from neighbor by casting the pointer to (node_pt)
+    node_pt near_node = (node_pt)neighbor;
+
+    // near a block of a lane means in that lane
+    if(pool_mgr->lanes != NULL)
+    {
+        pool_mgr_pt lane = _mem_find_lane(pool_mgr, near_node);
+        if(lane != NULL)
+        {
+            return mem_new_alloc_near((pool_pt)lane, size, neighbor);
+        }
+        return _mem_lanes_new_alloc(pool_mgr, size, MEM_HINT_NONE);
+    }
+
+    if(! _mem_is_owner(pool_mgr) || (pool_mgr->flags & MEM_POOL_NO_NODES))
+    {
+        return NULL;
+    }
+    _mem_drain_remote_frees(pool_mgr);
+    _mem_reclaim_deferred(pool_mgr);
+
+    _mem_lock(pool_mgr);
+    void * alloc = _mem_new_alloc_near(pool_mgr, size, near_node);
+    _mem_unlock(pool_mgr);
+
+    return alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, void * alloc) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // get node from alloc by casting the pointer to (node_pt)
+    node_pt node = (node_pt)alloc;
+
+    // a laned pool passes it on to the lane that has the node, which may
+    // then have room to give back what it took from the next lane
+    if(pool_mgr->lanes != NULL)
+    {
+        pool_mgr_pt lane = _mem_find_lane(pool_mgr, node);
+        if(lane == NULL)
+        {
+            return ALLOC_NOT_FREED;
+        }
+
+        alloc_status result = mem_del_alloc((pool_pt)lane, alloc);
+        if(result == ALLOC_OK)
+        {
+            _mem_lanes_give_back(pool_mgr, lane);
+        }
+        return result;
+    }
+
+    // find the node in the node heap
+    // make sure it's found and it is an allocation
+    if(! _mem_is_heap_node(pool_mgr, node)
+       || node->used == 0 || node->allocated == 0 || node->cached
+       || atomic_load_explicit(&node->remote, memory_order_relaxed) || node->deferred)
+    {
+        return ALLOC_NOT_FREED;
+    }
+
+    // another thread hands the block back to the owner of the pool
+    // note: the flag is claimed with a compare-and-swap, so that two
+    //       threads freeing the same block don't both push it
+    if(! _mem_is_owner(pool_mgr))
+    {
+        unsigned remote = 0;
+        if(! atomic_compare_exchange_strong(&node->remote, &remote, 1))
+        {
+            return ALLOC_NOT_FREED;
+        }
+
+        _mem_push_remote_free(pool_mgr, node);
+        return ALLOC_OK;
+    }
+    _mem_drain_remote_frees(pool_mgr);
+
+    // keep a small block in the thread cache, if on
+    if(atomic_load_explicit(&pool_mgr->tcache, memory_order_relaxed)
+       && _mem_tcache_free(pool_mgr, node) == ALLOC_OK)
+    {
+        return ALLOC_OK;
+    }
+
+    _mem_lock(pool_mgr);
+    alloc_status result = _mem_del_alloc(pool_mgr, node);
+    _mem_unlock(pool_mgr);
+
+    return result;
+}
+
+// note: the block stays an allocation until every thread that was inside
+//       an epoch when it was freed has left it, two epochs on, and goes
+//       back to the gap index on a later call to the pool
+alloc_status mem_del_alloc_deferred(pool_pt pool, void * alloc) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // get node from alloc by casting the pointer to (node_pt)
+    node_pt node = (node_pt)alloc;
+
+    // a laned pool passes it on to the lane that has the node
+    if(pool_mgr->lanes != NULL)
+    {
+        pool_mgr_pt lane = _mem_find_lane(pool_mgr, node);
+        return lane != NULL ? mem_del_alloc_deferred((pool_pt)lane, alloc) : ALLOC_NOT_FREED;
+    }
+
+    // make sure it's an allocation, and not already on its way back
+    // note: the flag is claimed under the lock, so that two threads
+    //       freeing the same block don't both push it
+    _mem_lock(pool_mgr);
+    if(! _mem_is_heap_node(pool_mgr, node)
+       || node->used == 0 || node->allocated == 0 || node->cached
+       || atomic_load(&node->remote) || node->deferred)
+    {
+        _mem_unlock(pool_mgr);
+        return ALLOC_NOT_FREED;
+    }
+    node->deferred = 1;
+    _mem_unlock(pool_mgr);
+
+    node->deferred_epoch = atomic_load(&mem_epoch);
+    _mem_push_deferred_frees(pool_mgr, node, node);
+
+    // give back whatever older blocks are safe by now
+    _mem_reclaim_deferred(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: enters nest, only the outermost exit leaves the epoch
+alloc_status mem_epoch_enter() {
+    epoch_reader_pt reader = _mem_get_epoch_reader(1);
+    if(reader == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    if(reader->depth++ == 0)
+    {
+        // announce the epoch before reading anything it protects
+        atomic_store(&reader->epoch, atomic_load(&mem_epoch));
+        atomic_store(&reader->active, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_epoch_exit() {
+    epoch_reader_pt reader = _mem_get_epoch_reader(0);
+    if(reader == NULL || reader->depth == 0)
+    {
+        return ALLOC_FAIL;
+    }
+
+    if(--reader->depth == 0)
+    {
+        atomic_store_explicit(&reader->active, 0, memory_order_release);
+    }
+
+    return ALLOC_OK;
+}
+
+// note: blocks until a free leaves a gap large enough, or the timeout (in
+//       milliseconds) runs out; only shared and laned pools wait, others
+//       have no other thread to free for them, so this is mem_new_alloc;
+//       a laned pool's waiters are woken by the frees in any of its lanes
+void * mem_new_alloc_wait(pool_pt pool, size_t size, unsigned timeout_ms) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    void * alloc = mem_new_alloc(pool, size);
+    if(alloc != NULL || timeout_ms == 0 || size == 0 || size > pool->total_size
+       || ! (pool_mgr->flags & (MEM_POOL_SHARED | MEM_POOL_LANES)))
+    {
+        return alloc;
+    }
+
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    until.tv_sec += until.tv_nsec / 1000000000;
+    until.tv_nsec %= 1000000000;
+
+    // announce the wait before trying again, so that no free is missed
+    mtx_lock(&alloc_wait_lock);
+    if(atomic_fetch_add(&pool_mgr->waiters, 1) == 0 || size < atomic_load(&pool_mgr->wait_size))
+    {
+        atomic_store(&pool_mgr->wait_size, size);
+    }
+    mtx_unlock(&alloc_wait_lock);
+
+    for(;;)
+    {
+        unsigned free_gen = atomic_load(&pool_mgr->free_gen);
+
+        alloc = mem_new_alloc(pool, size);
+        if(alloc != NULL)
+        {
+            break;
+        }
+
+        unsigned timed_out = 0;
+        mtx_lock(&alloc_wait_lock);
+        while(atomic_load(&pool_mgr->free_gen) == free_gen && ! timed_out)
+        {
+            timed_out = cnd_timedwait(&alloc_wait_cond, &alloc_wait_lock, &until) == thrd_timedout;
+        }
+        mtx_unlock(&alloc_wait_lock);
+
+        // one last try, for a free that came in with the timeout
+        if(timed_out && atomic_load(&pool_mgr->free_gen) == free_gen)
+        {
+            alloc = mem_new_alloc(pool, size);
+            break;
+        }
+    }
+
+    mtx_lock(&alloc_wait_lock);
+    if(atomic_fetch_sub(&pool_mgr->waiters, 1) == 1)
+    {
+        atomic_store(&pool_mgr->wait_size, (size_t) -1);
+    }
+    mtx_unlock(&alloc_wait_lock);
+
+    return alloc;
+}
+
+// note: an arena hands out raw memory (no allocation record) by moving
+//       a shared offset, a fetch-add while there's room to spare and a
+//       compare-and-swap near the end, so that the last bytes aren't lost
+//       to an overshoot
+void * mem_arena_alloc(pool_pt pool, size_t size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+    size_t total_size = pool->total_size;
+
+    if(! (pool_mgr->flags & MEM_POOL_ARENA) || size == 0 || size > total_size)
+    {
+        return NULL;
+    }
+    size = (size + MEM_ARENA_ALIGN - 1) / MEM_ARENA_ALIGN * MEM_ARENA_ALIGN;
+
+    size_t offset = atomic_load_explicit(&pool_mgr->arena_offset, memory_order_relaxed);
+    if(offset <= total_size && total_size - offset >= size + MEM_ARENA_CAS_ZONE)
+    {
+        offset = atomic_fetch_add_explicit(&pool_mgr->arena_offset, size,
+                                           memory_order_relaxed);
+        if(offset <= total_size && total_size - offset >= size)
+        {
+            return pool->mem + offset;
+        }
+
+        // overshot, others got there first: undo unless someone bumped since
+        size_t end = offset + size;
+        atomic_compare_exchange_strong_explicit(&pool_mgr->arena_offset, &end, offset,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed);
+        offset = atomic_load_explicit(&pool_mgr->arena_offset, memory_order_relaxed);
+    }
+
+    while(offset <= total_size && total_size - offset >= size)
+    {
+        if(atomic_compare_exchange_weak_explicit(&pool_mgr->arena_offset, &offset,
+                                                 offset + size,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+        {
+            return pool->mem + offset;
+        }
+    }
+
+    return NULL;
+}
+
+// note: frees everything handed out by mem_arena_alloc, no allocation
+//       may be running at the same time
+alloc_status mem_arena_reset(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    if(! (pool_mgr->flags & MEM_POOL_ARENA))
+    {
+        return ALLOC_FAIL;
+    }
+    atomic_store(&pool_mgr->arena_offset, 0);
+
+    return ALLOC_OK;
+}
+
+// note: the free objects of a slab form a Treiber stack of object
+//       indices, the tag in the upper half of the head changes on every
+//       pop and push, so a pop that read a stale next index fails (no ABA)
+void * mem_slab_alloc(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    if(! (pool_mgr->flags & MEM_POOL_SLAB))
+    {
+        return NULL;
+    }
+
+    uint64_t head = atomic_load_explicit(&pool_mgr->slab_free, memory_order_acquire);
+    while((head & UINT32_MAX) != 0)
+    {
+        unsigned top = (unsigned) (head & UINT32_MAX) - 1;
+        uint64_t next = ((head >> 32) + 1) << 32
+                        | atomic_load_explicit(&pool_mgr->slab_next[top], memory_order_relaxed);
+
+        if(atomic_compare_exchange_weak_explicit(&pool_mgr->slab_free, &head, next,
+                                                 memory_order_acquire,
+                                                 memory_order_acquire))
+        {
+            atomic_store_explicit(&pool_mgr->slab_next[top], MEM_SLAB_IN_USE,
+                                  memory_order_relaxed);
+            atomic_fetch_add_explicit(&pool_mgr->slab_used, 1, memory_order_relaxed);
+            return pool->mem + top * pool_mgr->object_size;
+        }
+    }
+
+    return NULL;
+}
+
+alloc_status mem_slab_free(pool_pt pool, void *object) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+    char *mem = (char *) object;
+
+    // make sure it's the start of one of the slab's objects
+    if(! (pool_mgr->flags & MEM_POOL_SLAB)
+       || mem < pool->mem
+       || (size_t) (mem - pool->mem) % pool_mgr->object_size != 0
+       || (size_t) (mem - pool->mem) / pool_mgr->object_size >= pool_mgr->num_objects)
+    {
+        return ALLOC_NOT_FREED;
+    }
+    unsigned ix = (unsigned) ((size_t) (mem - pool->mem) / pool_mgr->object_size);
+
+    // and that it is in use (once)
+    unsigned in_use = MEM_SLAB_IN_USE;
+    if(! atomic_compare_exchange_strong_explicit(&pool_mgr->slab_next[ix], &in_use, 0,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+    {
+        return ALLOC_NOT_FREED;
+    }
+    atomic_fetch_sub_explicit(&pool_mgr->slab_used, 1, memory_order_relaxed);
+
+    uint64_t head = atomic_load_explicit(&pool_mgr->slab_free, memory_order_relaxed);
+    uint64_t next;
+    do
+    {
+        atomic_store_explicit(&pool_mgr->slab_next[ix], (unsigned) (head & UINT32_MAX),
+                              memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (ix + 1);
+    } while(! atomic_compare_exchange_weak_explicit(&pool_mgr->slab_free, &head, next,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+
+    return ALLOC_OK;
+}
+
+// note: blocks in the thread caches (and their depot) stay allocations as
+//       far as the pool is concerned, turning the caches off gives back this
+//       thread's blocks and the depot's, other threads give theirs back at
+//       exit or on mem_tcache_flush
+alloc_status mem_pool_set_tcache(pool_pt pool, unsigned enable) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_tcache, enable);
+    }
+
+    // the depot comes with the first use of the caches
+    if(enable)
+    {
+        _mem_spin_lock(&pool_mgr->depot_lock);
+        if(pool_mgr->depot == NULL)
+        {
+            pool_mgr->depot = (tcache_bin_pt) calloc(MEM_TCACHE_BINS, sizeof(tcache_bin_t));
+        }
+        tcache_bin_pt depot = pool_mgr->depot;
+        _mem_spin_unlock(&pool_mgr->depot_lock);
+
+        if(depot == NULL)
+        {
+            return ALLOC_FAIL;
+        }
+    }
+
+    atomic_store(&pool_mgr->tcache, enable ? 1 : 0);
+    if(! enable)
+    {
+        _mem_tcache_release(pool_mgr);
+    }
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_tcache_flush() {
+    _mem_tcache_destroy(thread_tcache);
+
+    if(pool_store != NULL)
+    {
+        tss_set(tcache_key, NULL);
+    }
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_quick_lists(pool_pt pool, unsigned threshold) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_quick_lists, threshold);
+    }
+
+    _mem_lock(pool_mgr);
+    alloc_status result = _mem_set_quick_lists(pool_mgr, threshold);
+    _mem_unlock(pool_mgr);
+
+    return result;
+}
+
+alloc_status mem_pool_set_policy(pool_pt pool, alloc_policy policy) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        alloc_status result = ALLOC_OK;
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            if(mem_pool_set_policy((pool_pt)pool_mgr->lanes[i], policy) != ALLOC_OK)
+            {
+                result = ALLOC_FAIL;
+            }
+        }
+        return result;
+    }
+
+    if(policy != FIRST_FIT && policy != BEST_FIT && policy != GOOD_FIT)
+    {
+        return ALLOC_FAIL;
+    }
+
+    _mem_lock(pool_mgr);
+    _mem_switch_policy(pool_mgr, policy);
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: the pool starts from (or keeps) its current policy, and the auto
+//       mode only ever switches between FIRST_FIT and BEST_FIT
+alloc_status mem_pool_set_auto_policy(pool_pt pool, unsigned enable) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_auto_policy, enable);
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->auto_policy = enable ? 1 : 0;
+    pool_mgr->auto_policy_allocs = 0;
+    pool_mgr->auto_policy_search = 0;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: the quick lists are LIFO already, this covers the indexed gaps
+alloc_status mem_pool_set_lifo_reuse(pool_pt pool, unsigned enable) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_lifo_reuse, enable);
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->lifo_reuse = enable ? 1 : 0;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: only allocations made while this is on are aligned, so turn it
+//       on before the first allocation to keep every block on its own lines
+alloc_status mem_pool_set_cache_align(pool_pt pool, unsigned enable) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_cache_align, enable);
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->cache_align = enable ? 1 : 0;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_cache_coloring(pool_pt pool, unsigned enable) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_cache_coloring, enable);
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->cache_coloring = enable ? 1 : 0;
+    pool_mgr->cache_color = 0;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_size_classes(pool_pt pool, alloc_size_class classes, size_t step) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        alloc_status result = ALLOC_OK;
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            if(mem_pool_set_size_classes((pool_pt)pool_mgr->lanes[i], classes, step) != ALLOC_OK)
+            {
+                result = ALLOC_FAIL;
+            }
+        }
+        return result;
+    }
+
+    if(classes != MEM_SIZE_EXACT && classes != MEM_SIZE_STEP
+       && classes != MEM_SIZE_GEOMETRIC)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // the grid needs a step
+    if(classes != MEM_SIZE_EXACT && step == 0)
+    {
+        return ALLOC_FAIL;
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->size_classes = classes;
+    pool_mgr->size_step = step;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: 0 (the default) splits off any remainder, however small
+alloc_status mem_pool_set_min_split(pool_pt pool, size_t min_split) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        alloc_status result = ALLOC_OK;
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            if(mem_pool_set_min_split((pool_pt)pool_mgr->lanes[i], min_split) != ALLOC_OK)
+            {
+                result = ALLOC_FAIL;
+            }
+        }
+        return result;
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->min_split = min_split;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_consolidate(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        alloc_status result = ALLOC_OK;
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            if(mem_pool_consolidate((pool_pt)pool_mgr->lanes[i]) != ALLOC_OK)
+            {
+                result = ALLOC_FAIL;
+            }
+        }
+        return result;
+    }
+
+    _mem_lock(pool_mgr);
+    alloc_status result = _mem_consolidate(pool_mgr);
+    _mem_unlock(pool_mgr);
+
+    return result;
+}
+
+// note: a laned pool adds up its lanes (and takes the longest hold), the
+//       query's own acquisition of the lock is counted
+alloc_status mem_pool_lock_stats(pool_pt pool, pool_lock_stats_pt stats) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    if(pool_mgr->lanes != NULL)
+    {
+        pool_lock_stats_t lane_stats;
+
+        memset(stats, 0, sizeof(pool_lock_stats_t));
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            mem_pool_lock_stats((pool_pt)pool_mgr->lanes[i], &lane_stats);
+            stats->acquisitions += lane_stats.acquisitions;
+            stats->contended += lane_stats.contended;
+            stats->wait_ns += lane_stats.wait_ns;
+            if(lane_stats.max_hold_ns > stats->max_hold_ns)
+            {
+                stats->max_hold_ns = lane_stats.max_hold_ns;
+            }
+        }
+        return ALLOC_OK;
+    }
+
+    // only a shared pool has a lock to profile
+    if(! (pool_mgr->flags & MEM_POOL_SHARED))
+    {
+        return ALLOC_FAIL;
+    }
+
+    _mem_lock(pool_mgr);
+    stats->acquisitions = pool_mgr->lock_acquisitions;
+    stats->contended = pool_mgr->lock_contended;
+    stats->wait_ns = pool_mgr->lock_wait_ns;
+    stats->max_hold_ns = pool_mgr->lock_max_hold_ns;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+// note: a pass of what the maintenance thread does, on the calling thread;
+//       it takes each pool's lock, and the pools without a lock (which
+//       belong to one thread) aren't touched, so any thread may call it
+alloc_status mem_maintain() {
+    if(pool_store == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    mtx_lock(&maintenance_lock);
+    _mem_maintain_store();
+    mtx_unlock(&maintenance_lock);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_set_search_limit(pool_pt pool, unsigned max_candidates) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    // a laned pool passes it on to its lanes
+    if(pool_mgr->lanes != NULL)
+    {
+        return _mem_lanes_set(pool_mgr, mem_pool_set_search_limit, max_candidates);
+    }
+
+    // GOOD_FIT has to look at one candidate at least
+    if(max_candidates == 0)
+    {
+        return ALLOC_FAIL;
+    }
+
+    _mem_lock(pool_mgr);
+    pool_mgr->search_limit = max_candidates;
+    _mem_unlock(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments) {
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    if(pool_mgr->lanes != NULL)
+    {
+        _mem_inspect_lanes(pool_mgr, segments, num_segments);
+        return;
+    }
+
+    _mem_lock(pool_mgr);
+
+    node_pt temp = pool_mgr->node_heap;
+    // allocate the segments array with size == used_nodes
+    // NEED TO FREE LATER
+    pool_segment_pt seg_array = (pool_segment_pt) calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
+    // check successful
+    if(seg_array == NULL)
+    {
+        _mem_unlock(pool_mgr);
+        return;
+    }
+
+    // loop through the node heap and the segments array
+    // note: blocks on the quick lists show up as (uncoalesced) gaps
+    for(unsigned i = 0; i < pool_mgr->used_nodes; i++)
+    {
+        //    for each node, write the size and allocated in the segment
+        seg_array[i].size = temp->alloc_record.size;
+        seg_array[i].allocated = temp->allocated;
+
+        temp = temp->next;
+    }
+
+    // "return" the values:
+    *segments = seg_array;
+    *num_segments = pool_mgr->used_nodes;
+
+    _mem_unlock(pool_mgr);
+}
+
+// note: fills the caller's buffer without stopping allocation, a shared
+//       pool is read between writers (a seqlock); if the segments don't
+//       fit, num_segments is how many there were; a laned pool's lanes
+//       are each consistent, but not with each other
+alloc_status mem_inspect_pool_snapshot(pool_pt pool, pool_segment_pt segments,
+                                       unsigned capacity, unsigned *num_segments) {
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+
+    if(pool_mgr->lanes == NULL)
+    {
+        return _mem_snapshot_segments(pool_mgr, segments, capacity, num_segments);
+    }
+
+    alloc_status result = ALLOC_OK;
+    unsigned seg = 0;
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+    {
+        unsigned lane_segments = 0;
+
+        if(_mem_snapshot_segments(pool_mgr->lanes[i], segments + (result == ALLOC_OK ? seg : 0),
+                                  result == ALLOC_OK ? capacity - seg : 0,
+                                  &lane_segments) != ALLOC_OK)
+        {
+            result = ALLOC_FAIL;
+        }
+        seg += lane_segments;
+    }
+    *num_segments = seg;
+
+    return result;
+}
+
+pool_group_pt mem_pool_group_open(unsigned num_shards, size_t size, alloc_policy policy) {
+    // make sure there is a shard at least
+    if(num_shards == 0)
+    {
+        return NULL;
+    }
+
+    // allocate a new group mgr and its shard arrays
+    pool_group_mgr_pt group_mgr = (pool_group_mgr_pt) calloc(1, sizeof(pool_group_mgr_t));
+    if(group_mgr == NULL)
+    {
+        return NULL;
+    }
+    group_mgr->shards = (pool_pt*) calloc(num_shards, sizeof(pool_pt));
+    group_mgr->shards_by_mem = (pool_pt*) calloc(num_shards, sizeof(pool_pt));
+    if(group_mgr->shards == NULL || group_mgr->shards_by_mem == NULL)
+    {
+        free(group_mgr->shards);
+        free(group_mgr->shards_by_mem);
+        free(group_mgr);
+        return NULL;
+    }
+
+    // open a pool of the given size for each shard
+    // note: a thread can move to another CPU in the middle of a call,
+    //       so the shards still need a lock (uncontended most of the time)
+    for(unsigned i = 0; i < num_shards; i++)
+    {
+        group_mgr->shards[i] = mem_pool_open_ex(size, policy, MEM_POOL_SHARED);
+        if(group_mgr->shards[i] == NULL)
+        {
+            while(i-- > 0)
+            {
+                mem_pool_close(group_mgr->shards[i]);
+            }
+            free(group_mgr->shards);
+            free(group_mgr->shards_by_mem);
+            free(group_mgr);
+            return NULL;
+        }
+        group_mgr->shards_by_mem[i] = group_mgr->shards[i];
+    }
+    qsort(group_mgr->shards_by_mem, num_shards, sizeof(pool_pt), _mem_compare_pool_mem);
+
+    group_mgr->group.num_shards = num_shards;
+    group_mgr->group.shard_size = size;
+    group_mgr->group.policy = policy;
+
+    return (pool_group_pt)group_mgr;
+}
+
+alloc_status mem_pool_group_close(pool_group_pt group) {
+    // get mgr from group by casting the pointer to (pool_group_mgr_pt)
+    pool_group_mgr_pt group_mgr = (pool_group_mgr_pt)group;
+
+    // check that all of the shards are empty before closing any
+    for(unsigned i = 0; i < group->num_shards; i++)
+    {
+        if(group_mgr->shards[i]->num_allocs != 0)
+        {
+            return ALLOC_NOT_FREED;
+        }
+    }
+
+    for(unsigned i = 0; i < group->num_shards; i++)
+    {
+        mem_pool_close(group_mgr->shards[i]);
+    }
+    free(group_mgr->shards);
+    free(group_mgr->shards_by_mem);
+    free(group_mgr);
+
+    return ALLOC_OK;
+}
+
+void * mem_group_new_alloc(pool_group_pt group, size_t size) {
+    // get mgr from group by casting the pointer to (pool_group_mgr_pt)
+    pool_group_mgr_pt group_mgr = (pool_group_mgr_pt)group;
+
+    // the shard of the current CPU first, the others in turn if it is full
+    unsigned home = _mem_home_shard(group->num_shards);
+    for(unsigned i = 0; i < group->num_shards; i++)
+    {
+        void * alloc = mem_new_alloc(group_mgr->shards[(home + i) % group->num_shards], size);
+        if(alloc != NULL)
+        {
+            return alloc;
+        }
+    }
+
+    return NULL;
+}
+
+alloc_status mem_group_del_alloc(pool_group_pt group, void * alloc) {
+    // get mgr from group by casting the pointer to (pool_group_mgr_pt)
+    pool_group_mgr_pt group_mgr = (pool_group_mgr_pt)group;
+
+    // the block goes back to the shard it came from, whatever the CPU
+    pool_pt shard = _mem_group_find_shard(group_mgr, (alloc_pt)alloc);
+    if(shard == NULL)
+    {
+        return ALLOC_NOT_FREED;
+    }
+
+    return mem_del_alloc(shard, alloc);
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// note: block k of the pool store holds MEM_POOL_STORE_INIT_CAPACITY
+//       * MEM_POOL_STORE_EXPAND_FACTOR^k slots, a missing block is created
+//       on demand (the loser of a race frees its copy)
+static pool_slot_pt _mem_pool_store_slot(unsigned ix, unsigned create)
+{
+    unsigned capacity = MEM_POOL_STORE_INIT_CAPACITY;
+
+    for(unsigned k = 0; k < MEM_POOL_STORE_BLOCKS_MAX; k++)
+    {
+        if(ix < capacity)
+        {
+            pool_slot_pt block = atomic_load_explicit(&pool_store[k], memory_order_acquire);
+            if(block == NULL && create)
+            {
+                pool_slot_pt new_block = (pool_slot_pt) calloc(capacity, sizeof(pool_slot_t));
+                if(new_block == NULL)
+                {
+                    return NULL;
+                }
+                if(atomic_compare_exchange_strong_explicit(&pool_store[k], &block, new_block,
+                                                           memory_order_acq_rel,
+                                                           memory_order_acquire))
+                {
+                    block = new_block;
+                }
+                else
+                {
+                    free(new_block);
+                }
+            }
+
+            return block == NULL ? NULL : &block[ix];
+        }
+
+        ix -= capacity;
+        capacity *= MEM_POOL_STORE_EXPAND_FACTOR;
+    }
+
+    return NULL;
+}
+
+// pop a slot off the free stack, or hand out a new one
+// note: the tag in the upper half of the stack head changes on every
+//       push and pop, so a slot popped and pushed again in between
+//       fails the compare-and-swap (no ABA)
+static alloc_status _mem_claim_pool_store_slot(unsigned *ix)
+{
+    uint64_t head = atomic_load_explicit(&pool_store_free, memory_order_acquire);
+
+    while((head & UINT32_MAX) != 0)
+    {
+        unsigned top = (unsigned) (head & UINT32_MAX) - 1;
+        pool_slot_pt slot = _mem_pool_store_slot(top, 0);
+        uint64_t next = ((head >> 32) + 1) << 32
+                        | atomic_load_explicit(&slot->next_free, memory_order_relaxed);
+
+        if(atomic_compare_exchange_weak_explicit(&pool_store_free, &head, next,
+                                                 memory_order_acquire,
+                                                 memory_order_acquire))
+        {
+            *ix = top;
+            return ALLOC_OK;
+        }
+    }
+
+    // nothing to reuse
+    unsigned new_ix = atomic_fetch_add(&pool_store_size, 1);
+    if(_mem_pool_store_slot(new_ix, 1) == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+    *ix = new_ix;
+
+    return ALLOC_OK;
+}
+
+static void _mem_release_pool_store_slot(unsigned ix)
+{
+    pool_slot_pt slot = _mem_pool_store_slot(ix, 0);
+    uint64_t head = atomic_load_explicit(&pool_store_free, memory_order_relaxed);
+    uint64_t next;
+
+    do
+    {
+        atomic_store_explicit(&slot->next_free, (unsigned) (head & UINT32_MAX),
+                              memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (ix + 1);
+    } while(! atomic_compare_exchange_weak_explicit(&pool_store_free, &head, next,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+// set the pool of a claimed slot (NULL to clear it), readers see either
+// the old or the new contents, never a mix
+static void _mem_publish_pool_store_slot(pool_slot_pt slot, pool_mgr_pt pool_mgr)
+{
+    unsigned version = atomic_load_explicit(&slot->version, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&slot->pool_mgr, pool_mgr, memory_order_relaxed);
+    atomic_store_explicit(&slot->mem,
+                          pool_mgr ? (uintptr_t) pool_mgr->pool.mem : 0,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->size,
+                          pool_mgr ? pool_mgr->pool.total_size : 0,
+                          memory_order_relaxed);
+
+    atomic_store_explicit(&slot->version, version + 2, memory_order_release);
+}
+
+// note: the node heap grows by adding blocks instead of moving to a larger
+//       array, so the allocation records handed out to the user stay valid
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr, float fill_factor)
+{
+    // see above
+    if(((float)pool_mgr->used_nodes / pool_mgr->total_nodes) > fill_factor)
+    {
+        // Get new size (the new block doubles the total)
+        unsigned block_capacity =
+                pool_mgr->total_nodes * (MEM_NODE_HEAP_EXPAND_FACTOR - 1);
+
+        // The block list doesn't grow, so it can be read without the lock
+        // (the blocks double the total, so it takes a lot to fill it)
+        if(pool_mgr->num_node_blocks == MEM_NODE_BLOCKS_MAX)
+        {
+            return ALLOC_FAIL;
+        }
+
+        // Allocate new block
+        node_pt new_nodes = calloc(block_capacity, sizeof(node_t));
+        // Check success
+        if(new_nodes == NULL)
+        {
+            return ALLOC_FAIL;
+        }
+
+        pool_mgr->node_blocks[pool_mgr->num_node_blocks].nodes = new_nodes;
+        pool_mgr->node_blocks[pool_mgr->num_node_blocks].capacity = block_capacity;
+        atomic_fetch_add(&pool_mgr->num_node_blocks, 1);
+
+        // Push the new nodes on the unused stack, lowest address on top
+        for(unsigned i = block_capacity; i > 0; i--)
+        {
+            _mem_put_unused_node(pool_mgr, &new_nodes[i - 1]);
+        }
+
+        pool_mgr->total_nodes += block_capacity;
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr, float fill_factor)
+{
+    // see above
+    if(((float)pool_mgr->gap_ix_size / pool_mgr->gap_ix_capacity) > fill_factor)
+    {
+        unsigned new_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
+
+        gap_pt new_gap_ix = realloc(pool_mgr->gap_ix, new_capacity * sizeof(gap_t));
+
+        if(new_gap_ix == NULL)
+        {
+            return ALLOC_FAIL;
+        }
+
+        pool_mgr->gap_ix = new_gap_ix;
+
+        // the hash grows along with the index (updates the capacity)
+        if(_mem_rehash_gap_ix(pool_mgr, new_capacity) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       node_pt node)
+{
+
+    // expand the gap index, if necessary (call the function)
+    alloc_status result = _mem_resize_gap_ix(pool_mgr, MEM_GAP_IX_FILL_FACTOR);
+    if (result != ALLOC_OK)
+    {
+        return ALLOC_FAIL;
+    }
+    // add the entry at the end
+    pool_mgr->gap_ix[pool_mgr->gap_ix_size].size = size;
+    pool_mgr->gap_ix[pool_mgr->gap_ix_size].node = node;
+
+    // update metadata (num_gaps)
+    pool_mgr->gap_ix_size += 1;
+    pool_mgr->pool.num_gaps += 1;
+
+    // add to the exact-fit hash, the recency list (and the address-ordered list)
+    _mem_add_to_gap_hash(pool_mgr, node);
+    _mem_add_to_recent_list(pool_mgr, node);
+    if(pool_mgr->pool.policy == GOOD_FIT)
+    {
+        _mem_add_to_gap_list(pool_mgr, node);
+    }
+
+    // sort the gap index (call the function)
+    result = _mem_sort_gap_ix(pool_mgr);
+
+    // check success
+    return result;
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
+                                            size_t size,
+                                            node_pt node)
+{
+    // find the position of the node in the gap index
+    // (among the entries of the same size)
+    unsigned i = _mem_gap_ix_lower_bound(pool_mgr, size);
+    while(i < pool_mgr->gap_ix_size && pool_mgr->gap_ix[i].size == size
+          && pool_mgr->gap_ix[i].node != node)
+    {
+        i++;
+    }
+    if(i == pool_mgr->gap_ix_size || pool_mgr->gap_ix[i].node != node)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // remove from the exact-fit hash, the recency list (and the address-ordered list)
+    _mem_remove_from_gap_hash(pool_mgr, node);
+    _mem_remove_from_recent_list(pool_mgr, node);
+    if(pool_mgr->pool.policy == GOOD_FIT)
+    {
+        _mem_remove_from_gap_list(pool_mgr, node);
+    }
+
+    // loop from there to the end of the array:
+    //    pull the entries (i.e. copy over) one position up
+    //    this effectively deletes the chosen node
+    memmove(&pool_mgr->gap_ix[i], &pool_mgr->gap_ix[i + 1],
+            (pool_mgr->gap_ix_size - i - 1) * sizeof(gap_t));
+
+    // update metadata (num_gaps)
+    pool_mgr->gap_ix_size -= 1;
+    pool_mgr->pool.num_gaps -= 1;
+
+    // zero out the element at position gap_ix_size!
+    pool_mgr->gap_ix[pool_mgr->gap_ix_size].size = 0;
+    pool_mgr->gap_ix[pool_mgr->gap_ix_size].node = NULL;
+
+    return ALLOC_OK;
+}
+
+// note: only called by _mem_add_to_gap_ix, which appends a single entry
+static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr)
+{
+    // the new entry is at the end, so "bubble it up"
+    // loop from gap_ix_size - 1 until but not including 0:
+
+    gap_t temp;
+
+    for(unsigned i = pool_mgr->gap_ix_size - 1; i > 0; i--)
+    {
+        // if the size of the current entry is less than the previous (u - 1)
+        // or if the sizes are the same but the current entry points to a
+        // node with a lower address of pool allocation address (mem)
+        if(pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i - 1].size
+           || (pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i - 1].size
+               && pool_mgr->gap_ix[i].node->alloc_record.mem
+                  < pool_mgr->gap_ix[i - 1].node->alloc_record.mem))
+        {
+            // swap them (by copying) (remember to use a temporary variable)
+            temp = pool_mgr->gap_ix[i];
+
+            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i - 1];
+
+            pool_mgr->gap_ix[i - 1] = temp;
+        }
+        else
+        {
+            // the rest of the index is already in order
+            break;
+        }
+    }
+    return ALLOC_OK;
+}
+
+// index of the first gap in the gap index of at least the given size
+static unsigned _mem_gap_ix_lower_bound(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned low = 0;
+    unsigned high = pool_mgr->gap_ix_size;
+
+    while(low < high)
+    {
+        unsigned mid = low + (high - low) / 2;
+
+        if(pool_mgr->gap_ix[mid].size < size)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+// rebuild the exact-fit hash with a new number of buckets
+static alloc_status _mem_rehash_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity)
+{
+    node_pt *new_gap_hash = (node_pt*) calloc(capacity, sizeof(node_pt));
+    if(new_gap_hash == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    free(pool_mgr->gap_hash);
+    pool_mgr->gap_hash = new_gap_hash;
+    pool_mgr->gap_ix_capacity = capacity;
+
+    for(unsigned i = 0; i < pool_mgr->gap_ix_size; i++)
+    {
+        _mem_add_to_gap_hash(pool_mgr, pool_mgr->gap_ix[i].node);
+    }
+
+    return ALLOC_OK;
+}
+
+static void _mem_add_to_gap_hash(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node_pt *bucket = &pool_mgr->gap_hash[
+            _mem_hash_size(node->alloc_record.size, pool_mgr->gap_ix_capacity)];
+
+    node->size_prev = NULL;
+    node->size_next = *bucket;
+    if(*bucket != NULL)
+    {
+        (*bucket)->size_prev = node;
+    }
+    *bucket = node;
+}
+
+static void _mem_remove_from_gap_hash(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(node->size_prev != NULL)
+    {
+        node->size_prev->size_next = node->size_next;
+    }
+    else
+    {
+        pool_mgr->gap_hash[_mem_hash_size(node->alloc_record.size,
+                                          pool_mgr->gap_ix_capacity)] = node->size_next;
+    }
+    if(node->size_next != NULL)
+    {
+        node->size_next->size_prev = node->size_prev;
+    }
+
+    node->size_next = NULL;
+    node->size_prev = NULL;
+}
+
+// the indexed gap of exactly the given size with the lowest address, if any
+// note: with LIFO reuse, the most recently indexed one instead (the hash
+//       chains are pushed at the front, so that is the first match)
+static node_pt _mem_find_exact_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    node_pt found = NULL;
+
+    for(node_pt node = pool_mgr->gap_hash[_mem_hash_size(size, pool_mgr->gap_ix_capacity)];
+        node != NULL; node = node->size_next)
+    {
+        if(node->alloc_record.size == size
+           && (found == NULL || node->alloc_record.mem < found->alloc_record.mem))
+        {
+            found = node;
+            if(pool_mgr->lifo_reuse)
+            {
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+static int _mem_is_indexed_gap(pool_mgr_pt pool_mgr, node_pt node)
+{
+    return node->allocated == 0 && node->quick == 0 && node != pool_mgr->top_node;
+}
+
+// note: not the same as an indexed gap while a split or a merge is under
+//       way, the gaps it creates are added to the list one at a time
+static int _mem_is_on_gap_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    return node->gap_prev != NULL || pool_mgr->gap_list == node;
+}
+
+// link a newly indexed gap between its nearest indexed neighbours,
+// searching outwards in both directions so the walk stays short
+static void _mem_add_to_gap_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node_pt before = node->prev;
+    node_pt after = node->next;
+    node_pt gap_prev = NULL;
+    node_pt gap_next = NULL;
+
+    while(before != NULL || after != NULL)
+    {
+        if(before != NULL && _mem_is_on_gap_list(pool_mgr, before))
+        {
+            gap_prev = before;
+            gap_next = before->gap_next;
+            break;
+        }
+        if(after != NULL && _mem_is_on_gap_list(pool_mgr, after))
+        {
+            gap_prev = after->gap_prev;
+            gap_next = after;
+            break;
+        }
+        before = before ? before->prev : NULL;
+        after = after ? after->next : NULL;
+    }
+
+    node->gap_prev = gap_prev;
+    node->gap_next = gap_next;
+    if(gap_prev != NULL)
+    {
+        gap_prev->gap_next = node;
+    }
+    else
+    {
+        pool_mgr->gap_list = node;
+    }
+    if(gap_next != NULL)
+    {
+        gap_next->gap_prev = node;
+    }
+}
+
+static void _mem_remove_from_gap_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(pool_mgr->gap_rover == node)
+    {
+        pool_mgr->gap_rover = node->gap_next;
+    }
+
+    if(node->gap_prev != NULL)
+    {
+        node->gap_prev->gap_next = node->gap_next;
+    }
+    else
+    {
+        pool_mgr->gap_list = node->gap_next;
+    }
+    if(node->gap_next != NULL)
+    {
+        node->gap_next->gap_prev = node->gap_prev;
+    }
+
+    node->gap_next = NULL;
+    node->gap_prev = NULL;
+}
+
+// link all indexed gaps in address order, for a switch to GOOD_FIT
+static void _mem_build_gap_list(pool_mgr_pt pool_mgr)
+{
+    node_pt last = NULL;
+
+    pool_mgr->gap_list = NULL;
+    pool_mgr->gap_rover = NULL;
+
+    for(node_pt node = pool_mgr->node_heap; node != NULL; node = node->next)
+    {
+        if(! _mem_is_indexed_gap(pool_mgr, node))
+        {
+            continue;
+        }
+
+        node->gap_prev = last;
+        node->gap_next = NULL;
+        if(last != NULL)
+        {
+            last->gap_next = node;
+        }
+        else
+        {
+            pool_mgr->gap_list = node;
+        }
+        last = node;
+    }
+}
+
+static void _mem_add_to_recent_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node->recent_prev = NULL;
+    node->recent_next = pool_mgr->gap_recent;
+    if(pool_mgr->gap_recent != NULL)
+    {
+        pool_mgr->gap_recent->recent_prev = node;
+    }
+    pool_mgr->gap_recent = node;
+}
+
+static void _mem_remove_from_recent_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(node->recent_prev != NULL)
+    {
+        node->recent_prev->recent_next = node->recent_next;
+    }
+    else
+    {
+        pool_mgr->gap_recent = node->recent_next;
+    }
+    if(node->recent_next != NULL)
+    {
+        node->recent_next->recent_prev = node->recent_prev;
+    }
+
+    node->recent_next = NULL;
+    node->recent_prev = NULL;
+}
+
+// the most recently indexed sufficient gap among the last few, if any
+// note: a freed block is indexed after merging with its neighbours, so
+//       the head of the list holds the bytes most likely still in cache
+static node_pt _mem_find_recent_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    node_pt node = pool_mgr->gap_recent;
+
+    for(unsigned examined = 0; node != NULL && examined < MEM_LIFO_SEARCH_LIMIT; examined++)
+    {
+        if(node->alloc_record.size >= size)
+        {
+            return node;
+        }
+        node = node->recent_next;
+    }
+
+    return NULL;
+}
+
+// FIRST_FIT and BEST_FIT share the gap index, GOOD_FIT also needs
+// the address-ordered gap list
+static void _mem_switch_policy(pool_mgr_pt pool_mgr, alloc_policy policy)
+{
+    if(policy == pool_mgr->pool.policy)
+    {
+        return;
+    }
+
+    if(policy == GOOD_FIT)
+    {
+        _mem_build_gap_list(pool_mgr);
+    }
+    else if(pool_mgr->pool.policy == GOOD_FIT)
+    {
+        while(pool_mgr->gap_list != NULL)
+        {
+            _mem_remove_from_gap_list(pool_mgr, pool_mgr->gap_list);
+        }
+        pool_mgr->gap_rover = NULL;
+    }
+
+    pool_mgr->pool.policy = policy;
+}
+
+// 1 - largest gap / free bytes, 0 when the free space is in one piece
+static float _mem_fragmentation(pool_mgr_pt pool_mgr)
+{
+    size_t free_size = pool_mgr->pool.total_size - pool_mgr->pool.alloc_size;
+    size_t largest_gap = 0;
+
+    if(pool_mgr->gap_ix_size > 0)
+    {
+        largest_gap = pool_mgr->gap_ix[pool_mgr->gap_ix_size - 1].size;
+    }
+    if(pool_mgr->top_node != NULL && pool_mgr->top_node->alloc_record.size > largest_gap)
+    {
+        largest_gap = pool_mgr->top_node->alloc_record.size;
+    }
+
+    if(free_size == 0)
+    {
+        return 0;
+    }
+
+    return 1 - (float)largest_gap / free_size;
+}
+
+// FIRST_FIT is cheap while a pool fills (most allocations come off the
+// top chunk), BEST_FIT fragments less once the pool churns: go by the
+// number of gaps a FIRST_FIT search has to look at (all the sufficient
+// ones) and by the fragmentation of the free space
+static void _mem_auto_policy(pool_mgr_pt pool_mgr, unsigned first_fit_ix)
+{
+    unsigned search_length = pool_mgr->gap_ix_size - first_fit_ix;
+
+    pool_mgr->auto_policy_search +=
+            (search_length - pool_mgr->auto_policy_search) * MEM_AUTO_POLICY_SMOOTHING;
+
+    if(++pool_mgr->auto_policy_allocs < MEM_AUTO_POLICY_PERIOD)
+    {
+        return;
+    }
+    pool_mgr->auto_policy_allocs = 0;
+
+    float fragmentation = _mem_fragmentation(pool_mgr);
+
+    if(pool_mgr->pool.policy != BEST_FIT
+       && (pool_mgr->auto_policy_search > MEM_AUTO_POLICY_MAX_SEARCH
+           || fragmentation > MEM_AUTO_POLICY_MAX_FRAG))
+    {
+        _mem_switch_policy(pool_mgr, BEST_FIT);
+    }
+    else if(pool_mgr->pool.policy != FIRST_FIT
+            && pool_mgr->auto_policy_search < MEM_AUTO_POLICY_MIN_SEARCH
+            && fragmentation < MEM_AUTO_POLICY_MIN_FRAG)
+    {
+        _mem_switch_policy(pool_mgr, FIRST_FIT);
+    }
+}
+
+// a gap at the end of the pool becomes the top chunk, any other is indexed
+static alloc_status _mem_add_gap(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(node->next == NULL)
+    {
+        assert(pool_mgr->top_node == NULL);
+
+        pool_mgr->top_node = node;
+        pool_mgr->pool.num_gaps += 1;
+
+        return ALLOC_OK;
+    }
+
+    return _mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node);
+}
+
+static alloc_status _mem_remove_gap(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(node == pool_mgr->top_node)
+    {
+        pool_mgr->top_node = NULL;
+        pool_mgr->pool.num_gaps -= 1;
+
+        return ALLOC_OK;
+    }
+
+    return _mem_remove_from_gap_ix(pool_mgr, node->alloc_record.size, node);
+}
+
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr)
+{
+    node_pt node = pool_mgr->unused_nodes;
+
+    if(node != NULL)
+    {
+        pool_mgr->unused_nodes = node->next;
+
+        node->used = 1;
+        _mem_store_unsigned(&node->allocated, 0);
+        node->quick = 0;
+        node->cached = 0;
+        _mem_store_node(&node->next, NULL);
+        node->prev = NULL;
+        node->quick_next = NULL;
+        node->size_next = NULL;
+        node->size_prev = NULL;
+        node->gap_next = NULL;
+        node->gap_prev = NULL;
+        node->recent_next = NULL;
+        node->recent_prev = NULL;
+
+        _mem_store_unsigned(&pool_mgr->used_nodes, pool_mgr->used_nodes + 1);
+    }
+
+    return node;
+}
+
+// note: used_nodes only counts nodes that are on the list, so the
+//       initial fill of a new block goes through here without taking it
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if(node->used)
+    {
+        _mem_store_unsigned(&pool_mgr->used_nodes, pool_mgr->used_nodes - 1);
+    }
+
+    node->used = 0;
+    _mem_store_unsigned(&node->allocated, 0);
+    node->quick = 0;
+    node->cached = 0;
+    node->prev = NULL;
+    node->quick_next = NULL;
+    node->alloc_record.mem = NULL;
+    _mem_store_size(&node->alloc_record.size, 0);
+
+    _mem_store_node(&node->next, pool_mgr->unused_nodes);
+    pool_mgr->unused_nodes = node;
+}
+
+// note: called without the lock by the thread caches
+static int _mem_is_heap_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    unsigned num_node_blocks = atomic_load(&pool_mgr->num_node_blocks);
+
+    for(unsigned i = 0; i < num_node_blocks; i++)
+    {
+        node_pt first = pool_mgr->node_blocks[i].nodes;
+
+        if(node >= first && node < first + pool_mgr->node_blocks[i].capacity)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void * _mem_new_alloc(pool_mgr_pt pool_mgr, size_t size, alloc_hint hint)
+{
+    // check if any gaps, return null if none
+    if(pool_mgr->pool.num_gaps == 0 || size == 0)
+    {
+        return NULL;
+    }
+    // a request too large for the pool can't wrap around below
+    size = _mem_request_size(pool_mgr, size);
+    if(size == 0 || size > pool_mgr->pool.total_size)
+    {
+        return NULL;
+    }
+
+    // a recently freed block of exactly this size needs no search and no split
+    if(pool_mgr->quick_lists != NULL)
+    {
+        node_pt quick_node = _mem_pop_quick_list(pool_mgr, size);
+        if(quick_node != NULL)
+        {
+            _mem_store_unsigned(&quick_node->allocated, 1);
+            pool_mgr->pool.num_allocs += 1;
+            pool_mgr->pool.alloc_size += size;
+
+            return (alloc_pt)quick_node;
+        }
+    }
+
+    // expand heap node, if necessary, quit on error
+    alloc_status result = _mem_resize_node_heap(pool_mgr, MEM_NODE_HEAP_FILL_FACTOR);
+    if(result != ALLOC_OK)
+    {
+        return NULL;
+    }
+
+    // with cache coloring, the allocation is offset by a rotating number
+    // of cache lines (the slack stays a gap)
+    size_t lead = 0;
+    if(pool_mgr->cache_coloring)
+    {
+        lead = pool_mgr->cache_color * MEM_CACHE_LINE;
+    }
+
+    // get a gap for allocation:
+    //   long-lived blocks go to the lowest sufficient gap, short-lived
+    //   ones to the highest, so the two don't interleave
+    //   if the gap found is too small once aligned, search again for
+    //   one that is large enough however it is aligned
+    node_pt gap_node = NULL;
+    size_t offset = MEM_NO_FIT;
+    for(unsigned attempt = 0; attempt < 2 && offset == MEM_NO_FIT; attempt++)
+    {
+        size_t search_size = size + lead;
+        if(attempt > 0 && pool_mgr->cache_align)
+        {
+            search_size += MEM_CACHE_LINE - 1;
+        }
+
+        if(hint == MEM_HINT_NONE)
+        {
+            gap_node = _mem_find_gap(pool_mgr, search_size);
+        }
+        else
+        {
+            gap_node = _mem_find_gap_by_address(pool_mgr, search_size, hint == MEM_HINT_SHORT);
+        }
+
+        // check if node found
+        if(gap_node == NULL)
+        {
+            return NULL;
+        }
+
+        offset = _mem_alloc_offset(pool_mgr, gap_node, size, lead, hint == MEM_HINT_SHORT);
+    }
+    if(offset == MEM_NO_FIT)
+    {
+        return NULL;
+    }
+
+    // return allocation record by casting the node to (alloc_pt)
+    // note: short-lived blocks are cut off the high end of the gap
+    node_pt alloc_node = _mem_split_gap(pool_mgr, gap_node, offset, size);
+    if(alloc_node != NULL && pool_mgr->cache_coloring)
+    {
+        pool_mgr->cache_color = (pool_mgr->cache_color + 1) % MEM_CACHE_COLORS;
+    }
+
+    return (alloc_pt)alloc_node;
+}
+
+// find a gap for the allocation according to the pool's policy
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    node_pt gap_node = NULL;
+
+    // the sufficient gaps are at the end of the gap index (sorted by size)
+    unsigned first_fit_ix = _mem_gap_ix_lower_bound(pool_mgr, size);
+
+    // in auto mode, the policy follows the search length and fragmentation
+    if(pool_mgr->auto_policy)
+    {
+        _mem_auto_policy(pool_mgr, first_fit_ix);
+    }
+
+    alloc_policy policy = pool_mgr->pool.policy;
+
+    // with LIFO reuse, a recently freed gap goes first, whatever the policy
+    // (the policy only decides when none of the last few fits)
+    if(pool_mgr->lifo_reuse)
+    {
+        gap_node = _mem_find_recent_gap(pool_mgr, size);
+        if(gap_node != NULL)
+        {
+            return gap_node;
+        }
+    }
+
+    // if BEST_FIT, then an exact match is found by hash
+    if(policy == BEST_FIT)
+    {
+        gap_node = _mem_find_exact_gap(pool_mgr, size);
+    }
+
+    // if FIRST_FIT, then find the sufficient gap with the lowest address
+    if(policy == FIRST_FIT)
+    {
+        for(unsigned i = first_fit_ix; i < pool_mgr->gap_ix_size; i++)
+        {
+            if(gap_node == NULL || pool_mgr->gap_ix[i].node->alloc_record.mem
+                                   < gap_node->alloc_record.mem)
+            {
+                gap_node = pool_mgr->gap_ix[i].node;
+            }
+        }
+    }
+
+    // if BEST_FIT without an exact match, then the first sufficient gap
+    // is the tightest
+    if(policy == BEST_FIT && gap_node == NULL
+       && first_fit_ix < pool_mgr->gap_ix_size)
+    {
+        gap_node = pool_mgr->gap_ix[first_fit_ix].node;
+    }
+
+    // if GOOD_FIT, then look at the next search_limit gaps in address
+    // order (picking up where the last search stopped) and take the
+    // tightest sufficient one, if none is then fall back on the tightest
+    // gap in the gap index
+    if(policy == GOOD_FIT && first_fit_ix < pool_mgr->gap_ix_size)
+    {
+        node_pt node = pool_mgr->gap_rover ? pool_mgr->gap_rover : pool_mgr->gap_list;
+
+        for(unsigned examined = 0; examined < pool_mgr->search_limit; examined++)
+        {
+            if(node->alloc_record.size >= size
+               && (gap_node == NULL
+                   || node->alloc_record.size < gap_node->alloc_record.size))
+            {
+                gap_node = node;
+                if(node->alloc_record.size == size)
+                {
+                    break;
+                }
+            }
+
+            node = node->gap_next ? node->gap_next : pool_mgr->gap_list;
+        }
+        pool_mgr->gap_rover = node;
+
+        if(gap_node == NULL)
+        {
+            gap_node = pool_mgr->gap_ix[first_fit_ix].node;
+        }
+    }
+
+    // bump off the top chunk when no better-fitting gap exists
+    // note: the top chunk has the highest address, so it never wins a tie,
+    //       and for FIRST_FIT it is only used when nothing else fits
+    node_pt top_node = pool_mgr->top_node;
+    if(top_node != NULL && top_node->alloc_record.size >= size
+       && (gap_node == NULL
+           || (policy != FIRST_FIT
+               && top_node->alloc_record.size < gap_node->alloc_record.size)))
+    {
+        gap_node = top_node;
+    }
+
+    return gap_node;
+}
+
+// the sufficient gap with the lowest (or highest) address
+static node_pt _mem_find_gap_by_address(pool_mgr_pt pool_mgr, size_t size, unsigned highest)
+{
+    node_pt gap_node = NULL;
+
+    // the top chunk has the highest address of all
+    if(highest && pool_mgr->top_node != NULL
+       && pool_mgr->top_node->alloc_record.size >= size)
+    {
+        return pool_mgr->top_node;
+    }
+
+    for(unsigned i = _mem_gap_ix_lower_bound(pool_mgr, size); i < pool_mgr->gap_ix_size; i++)
+    {
+        node_pt node = pool_mgr->gap_ix[i].node;
+
+        if(gap_node == NULL
+           || (highest ? node->alloc_record.mem > gap_node->alloc_record.mem
+                       : node->alloc_record.mem < gap_node->alloc_record.mem))
+        {
+            gap_node = node;
+        }
+    }
+
+    if(gap_node == NULL && pool_mgr->top_node != NULL
+       && pool_mgr->top_node->alloc_record.size >= size)
+    {
+        gap_node = pool_mgr->top_node;
+    }
+
+    return gap_node;
+}
+
+// the size actually allocated for a request: rounded up to its size
+// class, then to whole cache lines if aligning, 0 if that overflows
+static size_t _mem_request_size(pool_mgr_pt pool_mgr, size_t size)
+{
+    size_t step = pool_mgr->size_step;
+
+    // geometric classes are spaced by a fixed fraction of the power of two
+    // at or below the size (~12.5%), but never closer than the step
+    if(pool_mgr->size_classes == MEM_SIZE_GEOMETRIC)
+    {
+        size_t pow2 = 1;
+        while(pow2 <= size / 2)
+        {
+            pow2 <<= 1;
+        }
+        if(pow2 / MEM_SIZE_CLASSES_PER_DOUBLING > step)
+        {
+            step = pow2 / MEM_SIZE_CLASSES_PER_DOUBLING;
+        }
+    }
+
+    if(pool_mgr->size_classes != MEM_SIZE_EXACT)
+    {
+        if(size > SIZE_MAX - (step - 1))
+        {
+            return 0;
+        }
+        size = (size + step - 1) / step * step;
+    }
+
+    if(pool_mgr->cache_align)
+    {
+        if(size > SIZE_MAX - (MEM_CACHE_LINE - 1))
+        {
+            return 0;
+        }
+        size = (size + MEM_CACHE_LINE - 1) / MEM_CACHE_LINE * MEM_CACHE_LINE;
+    }
+
+    return size;
+}
+
+// where in the gap an allocation of the given size goes: lead bytes
+// off the low end of the gap, or off the high end if from_high is set,
+// moved down to a cache line if aligning, MEM_NO_FIT if it doesn't fit
+static size_t _mem_alloc_offset(pool_mgr_pt pool_mgr, node_pt gap_node,
+                                size_t size, size_t lead, unsigned from_high)
+{
+    size_t gap_size = gap_node->alloc_record.size;
+    size_t align = pool_mgr->cache_align ? MEM_CACHE_LINE : 1;
+    size_t offset = 0;
+
+    if(gap_size < size + lead)
+    {
+        return MEM_NO_FIT;
+    }
+
+    if(from_high)
+    {
+        offset = gap_size - size - lead;
+        size_t misalign = (uintptr_t)(gap_node->alloc_record.mem + offset) % align;
+
+        // a remainder too small to split off stays with the allocation
+        // (at the low end, _mem_split_gap takes care of it)
+        if(lead == 0 && align == 1 && offset < pool_mgr->min_split)
+        {
+            return 0;
+        }
+
+        return misalign <= offset ? offset - misalign : MEM_NO_FIT;
+    }
+
+    offset = lead + (align - (uintptr_t)(gap_node->alloc_record.mem + lead) % align) % align;
+
+    return offset + size <= gap_size ? offset : MEM_NO_FIT;
+}
+
+// turn part of a gap into an allocation of the given size, starting
+// offset bytes into the gap: the bytes before and after the allocation
+// stay gaps (the gap node keeps the ones before)
+// note: a remainder below the pool's minimum split is not worth a node
+//       and a gap index entry, the allocation gets it instead
+static node_pt _mem_split_gap(pool_mgr_pt pool_mgr, node_pt gap_node,
+                              size_t offset, size_t size)
+{
+    node_pt alloc_node = gap_node;
+    node_pt lead_node = NULL;
+    node_pt rem_node = NULL;
+
+    // calculate the size of the remaining gap, if any
+    size_t rem_gap_size = gap_node->alloc_record.size - offset - size;
+    if(rem_gap_size < pool_mgr->min_split)
+    {
+        size += rem_gap_size;
+        rem_gap_size = 0;
+    }
+
+    // make sure there are nodes for the leading and the remaining gap
+    if((size_t) (pool_mgr->total_nodes - pool_mgr->used_nodes)
+       < (size_t) (offset != 0) + (rem_gap_size != 0))
+    {
+        return NULL;
+    }
+
+    // remove node from gap index (or take over the top chunk)
+    _mem_remove_gap(pool_mgr, gap_node);
+
+    // adjust node heap:
+    //   if leading gap, the gap node keeps it and a new node is the allocation
+    if(offset)
+    {
+        alloc_node = _mem_get_unused_node(pool_mgr);
+        _mem_insert_node_after(gap_node, alloc_node);
+
+        alloc_node->alloc_record.mem = gap_node->alloc_record.mem + offset;
+        _mem_store_size(&gap_node->alloc_record.size, offset);
+        lead_node = gap_node;
+    }
+
+    //   if remaining gap, a new node right after the allocation
+    if(rem_gap_size)
+    {
+        rem_node = _mem_get_unused_node(pool_mgr);
+        _mem_insert_node_after(alloc_node, rem_node);
+
+        rem_node->alloc_record.mem = alloc_node->alloc_record.mem + size;
+        _mem_store_size(&rem_node->alloc_record.size, rem_gap_size);
+    }
+
+    // convert to an allocation node of given size
+    _mem_store_unsigned(&alloc_node->allocated, 1);
+    _mem_store_size(&alloc_node->alloc_record.size, size);
+
+    // add the gaps to the gap index (the remaining one might be the new
+    // top chunk)
+    if(lead_node)
+    {
+        _mem_add_gap(pool_mgr, lead_node);
+    }
+    if(rem_node)
+    {
+        _mem_add_gap(pool_mgr, rem_node);
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += size;
+
+    return alloc_node;
+}
+
+static void _mem_insert_node_after(node_pt node, node_pt new_node)
+{
+    _mem_store_node(&new_node->next, node->next);
+    if(node->next)
+    {
+        node->next->prev = new_node;
+    }
+    _mem_store_node(&node->next, new_node);
+    new_node->prev = node;
+}
+
+// merge a freed node with its neighbouring gaps and index the result
+static alloc_status _mem_release_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    // if the next node in the list is also a gap, merge into node-to-delete
+    if(node->next != NULL && node->next->allocated == 0 && node->next->quick == 0)
+    {
+        node_pt next = node->next;
+
+        //   remove the next node from gap index (or the top chunk)
+        //   check success
+        if(_mem_remove_gap(pool_mgr, next) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+        //   add the size to the node-to-delete
+        _mem_store_size(&node->alloc_record.size,
+                        node->alloc_record.size + next->alloc_record.size);
+
+        //   update linked list:
+        _mem_store_node(&node->next, next->next);
+        if(next->next)
+        {
+            next->next->prev = node;
+        }
+
+        //   update next as unused (and metadata (used nodes))
+        _mem_put_unused_node(pool_mgr, next);
+
+        // this merged node-to-delete might need to be added to the gap index
+        // but one more thing to check...
+    }
+    // if the previous node in the list is also a gap, merge into previous!
+    if(node->prev != NULL && node->prev->allocated == 0 && node->prev->quick == 0)
+    {
+        node_pt prev = node->prev;
+
+        //   remove the previous node from gap index
+        //   check success
+        if(_mem_remove_gap(pool_mgr, prev) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+
+        //   add the size of node-to-delete to the previous
+        _mem_store_size(&prev->alloc_record.size,
+                        prev->alloc_record.size + node->alloc_record.size);
+
+        //   update linked list:
+        _mem_store_node(&prev->next, node->next);
+        if(node->next)
+        {
+            node->next->prev = prev;
+        }
+
+        //   update node-to-delete as unused (and metadata (used nodes))
+        _mem_put_unused_node(pool_mgr, node);
+
+        // change the node to add to the previous node!
+        node = prev;
+    }
+
+    // wake the allocations waiting for a gap this large
+    _mem_wake_waiters(pool_mgr, node->alloc_record.size);
+
+    // add the resulting node to the gap index (or make it the top chunk)
+    return _mem_add_gap(pool_mgr, node);
+}
+
+static unsigned _mem_hash_size(size_t size, unsigned num_buckets)
+{
+    // multiplicative (Fibonacci) hashing spreads the common multiples of 8/16
+    unsigned long long hash = (unsigned long long) size * 0x9E3779B97F4A7C15ULL;
+
+    return (unsigned) ((hash >> 32) % num_buckets);
+}
+
+static alloc_status _mem_push_quick_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    quick_list_pt list = &pool_mgr->quick_lists[
+            _mem_hash_size(node->alloc_record.size, MEM_QUICK_LIST_BUCKETS)];
+
+    // a bucket holds a single exact size at a time
+    if(list->head != NULL && list->size != node->alloc_record.size)
+    {
+        return ALLOC_FAIL;
+    }
+
+    list->size = node->alloc_record.size;
+    node->quick = 1;
+    node->quick_next = list->head;
+    list->head = node;
+
+    pool_mgr->num_quick += 1;
+    pool_mgr->pool.num_gaps += 1;
+
+    return ALLOC_OK;
+}
+
+static node_pt _mem_pop_quick_list(pool_mgr_pt pool_mgr, size_t size)
+{
+    quick_list_pt list = &pool_mgr->quick_lists[
+            _mem_hash_size(size, MEM_QUICK_LIST_BUCKETS)];
+
+    if(list->head == NULL || list->size != size)
+    {
+        return NULL;
+    }
+
+    node_pt node = list->head;
+    list->head = node->quick_next;
+
+    node->quick = 0;
+    node->quick_next = NULL;
+
+    pool_mgr->num_quick -= 1;
+    pool_mgr->pool.num_gaps -= 1;
+
+    return node;
+}
+
+// free an allocation for good (past the thread cache)
+static alloc_status _mem_del_alloc(pool_mgr_pt pool_mgr, node_pt node)
+{
+    pool_pt pool = &pool_mgr->pool;
+
+    // convert to gap node
+    _mem_store_unsigned(&node->allocated, 0);
 
     // update metadata (num_allocs, alloc_size)
     pool->num_allocs -= 1;
     pool->alloc_size -= node->alloc_record.size;
 
-    // if the next node in the list is also a gap, merge into node-to-delete
-    if(node->next != NULL && node->next->allocated == 0)
+    // defer coalescing, if there is room on the quick list for this size
+    if(pool_mgr->quick_lists != NULL
+       && _mem_push_quick_list(pool_mgr, node) == ALLOC_OK)
+    {
+        _mem_wake_waiters(pool_mgr, node->alloc_record.size);
+
+        if(pool_mgr->num_quick > pool_mgr->quick_threshold)
+        {
+            return _mem_consolidate(pool_mgr);
+        }
+
+        return ALLOC_OK;
+    }
+
+    // merge with the neighbouring gaps and add to the gap index
+    return _mem_release_node(pool_mgr, node);
+}
+
+// this thread's cache for the pool, created on first use if asked to
+static tcache_pt _mem_get_tcache(pool_mgr_pt pool_mgr, unsigned create)
+{
+    for(tcache_pt tcache = thread_tcache; tcache != NULL; tcache = tcache->next)
+    {
+        if(tcache->pool_mgr == pool_mgr)
+        {
+            // left over from a closed pool at the same address
+            if(! atomic_load_explicit(&tcache->registered, memory_order_relaxed))
+            {
+                _mem_tcache_register(tcache);
+            }
+            return tcache;
+        }
+    }
+
+    if(! create)
+    {
+        return NULL;
+    }
+
+    tcache_pt tcache = (tcache_pt) calloc(1, sizeof(tcache_t));
+    if(tcache == NULL)
+    {
+        return NULL;
+    }
+    tcache->bins = (tcache_bin_pt) calloc(MEM_TCACHE_BINS, sizeof(tcache_bin_t));
+    if(tcache->bins == NULL)
+    {
+        free(tcache);
+        return NULL;
+    }
+
+    tcache->pool_mgr = pool_mgr;
+    atomic_init(&tcache->lock, 0);
+    atomic_init(&tcache->registered, 0);
+    _mem_tcache_register(tcache);
+
+    tcache->next = thread_tcache;
+    thread_tcache = tcache;
+    tss_set(tcache_key, thread_tcache);
+
+    return tcache;
+}
+
+// pop a block of the size class off this thread's cache; on a miss, refill
+// the bin from the depot, from another thread's cache, or from the pool
+// with a batch of blocks, in that order
+static node_pt _mem_tcache_alloc(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned bin_ix = (unsigned) ((size - 1) / MEM_TCACHE_GRANULE);
+    size_t class_size = (bin_ix + 1) * MEM_TCACHE_GRANULE;
+
+    tcache_pt tcache = _mem_get_tcache(pool_mgr, 1);
+    if(tcache == NULL)
+    {
+        _mem_lock(pool_mgr);
+        node_pt node = _mem_new_alloc(pool_mgr, size, MEM_HINT_NONE);
+        _mem_unlock(pool_mgr);
+
+        return node;
+    }
+
+    tcache_bin_pt bin = &tcache->bins[bin_ix];
+    _mem_spin_lock(&tcache->lock);
+    node_pt node = bin->head;
+    if(node != NULL)
+    {
+        bin->head = node->quick_next;
+        bin->count -= 1;
+    }
+    _mem_spin_unlock(&tcache->lock);
+
+    if(node == NULL)
+    {
+        unsigned count = 0;
+
+        node = _mem_depot_take(pool_mgr, bin_ix, &count);
+        if(node == NULL)
+        {
+            node = _mem_tcache_steal(tcache, bin_ix, &count);
+        }
+        if(node == NULL)
+        {
+            // one trip to the pool (and its lock) for the whole batch
+            _mem_lock(pool_mgr);
+            for(unsigned i = 0; i < MEM_TCACHE_BATCH; i++)
+            {
+                node_pt new_node = _mem_new_alloc(pool_mgr, class_size, MEM_HINT_NONE);
+                if(new_node == NULL)
+                {
+                    break;
+                }
+
+                new_node->cached = 1;
+                new_node->quick_next = node;
+                node = new_node;
+                count += 1;
+            }
+            _mem_unlock(pool_mgr);
+        }
+        if(node == NULL)
+        {
+            return NULL;
+        }
+
+        // keep the rest of the batch
+        if(count > 1)
+        {
+            node_pt tail = node->quick_next;
+            while(tail->quick_next != NULL)
+            {
+                tail = tail->quick_next;
+            }
+
+            _mem_spin_lock(&tcache->lock);
+            tail->quick_next = bin->head;
+            bin->head = node->quick_next;
+            bin->count += count - 1;
+            _mem_spin_unlock(&tcache->lock);
+        }
+    }
+
+    node->quick_next = NULL;
+    node->cached = 0;
+
+    return node;
+}
+
+// push a block on this thread's cache; past the high-water mark, the older
+// half of the bin goes to the depot, or to the pool if the depot is full
+// note: only blocks of exactly a class size are interchangeable
+static alloc_status _mem_tcache_free(pool_mgr_pt pool_mgr, node_pt node)
+{
+    size_t size = node->alloc_record.size;
+
+    if(size % MEM_TCACHE_GRANULE != 0 || size > MEM_TCACHE_BINS * MEM_TCACHE_GRANULE)
+    {
+        return ALLOC_FAIL;
+    }
+
+    tcache_pt tcache = _mem_get_tcache(pool_mgr, 1);
+    if(tcache == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    unsigned bin_ix = (unsigned) (size / MEM_TCACHE_GRANULE - 1);
+    tcache_bin_pt bin = &tcache->bins[bin_ix];
+    node_pt surplus = NULL;
+    unsigned count = 0;
+
+    node->cached = 1;
+    _mem_spin_lock(&tcache->lock);
+    node->quick_next = bin->head;
+    bin->head = node;
+    bin->count += 1;
+    if(bin->count > MEM_TCACHE_MAX)
+    {
+        surplus = _mem_tcache_detach(bin, MEM_TCACHE_MAX / 2, &count);
+    }
+    _mem_spin_unlock(&tcache->lock);
+
+    if(surplus != NULL)
+    {
+        _mem_tcache_give_back(pool_mgr, _mem_depot_put(pool_mgr, bin_ix, surplus, count));
+    }
+
+    // a waiter of the class takes it from here (or steals it)
+    _mem_wake_waiters(pool_mgr, size);
+
+    return ALLOC_OK;
+}
+
+// give back all but the keep most recently cached blocks of a bin
+static void _mem_tcache_flush(tcache_pt tcache, unsigned bin_ix, unsigned keep)
+{
+    unsigned count = 0;
+
+    _mem_spin_lock(&tcache->lock);
+    node_pt chain = _mem_tcache_detach(&tcache->bins[bin_ix], keep, &count);
+    _mem_spin_unlock(&tcache->lock);
+
+    _mem_tcache_give_back(tcache->pool_mgr, chain);
+}
+
+// give back this thread's cached blocks of the pool and the depot's, and
+// drop this thread's cache
+static void _mem_tcache_release(pool_mgr_pt pool_mgr)
+{
+    _mem_depot_release(pool_mgr);
+
+    for(tcache_pt *link = &thread_tcache; *link != NULL; link = &(*link)->next)
+    {
+        tcache_pt tcache = *link;
+
+        if(tcache->pool_mgr == pool_mgr)
+        {
+            _mem_tcache_unregister(tcache);
+            for(unsigned i = 0; i < MEM_TCACHE_BINS; i++)
+            {
+                _mem_tcache_flush(tcache, i, 0);
+            }
+
+            *link = tcache->next;
+            free(tcache->bins);
+            free(tcache);
+            tss_set(tcache_key, thread_tcache);
+
+            return;
+        }
+    }
+}
+
+// give back all of a thread's cached blocks and drop its caches
+// note: the tss destructor, so it runs at thread exit
+// note: caches of closed pools are empty, their pool is not touched
+static void _mem_tcache_destroy(void *tcache_list)
+{
+    tcache_pt tcache = (tcache_pt) tcache_list;
+
+    while(tcache != NULL)
+    {
+        tcache_pt next = tcache->next;
+
+        _mem_tcache_unregister(tcache);
+        for(unsigned i = 0; i < MEM_TCACHE_BINS; i++)
+        {
+            _mem_tcache_flush(tcache, i, 0);
+        }
+        free(tcache->bins);
+        free(tcache);
+
+        tcache = next;
+    }
+
+    thread_tcache = NULL;
+}
+
+// put a cache on its pool's list, where other threads can steal from it
+static void _mem_tcache_register(tcache_pt tcache)
+{
+    pool_mgr_pt pool_mgr = tcache->pool_mgr;
+
+    _mem_spin_lock(&pool_mgr->tcaches_lock);
+    tcache->pool_prev = NULL;
+    tcache->pool_next = pool_mgr->tcaches;
+    if(pool_mgr->tcaches != NULL)
+    {
+        pool_mgr->tcaches->pool_prev = tcache;
+    }
+    pool_mgr->tcaches = tcache;
+    atomic_store(&tcache->registered, 1);
+    _mem_spin_unlock(&pool_mgr->tcaches_lock);
+}
+
+// note: a closed pool has dropped its list, and the cache with it; the
+//       registry lock keeps the pool from being freed while it's checked
+static void _mem_tcache_unregister(tcache_pt tcache)
+{
+    _mem_spin_lock(&tcache_registry_lock);
+    if(atomic_load(&tcache->registered))
+    {
+        _mem_spin_lock(&tcache->pool_mgr->tcaches_lock);
+        if(tcache->pool_prev != NULL)
+        {
+            tcache->pool_prev->pool_next = tcache->pool_next;
+        }
+        else
+        {
+            tcache->pool_mgr->tcaches = tcache->pool_next;
+        }
+        if(tcache->pool_next != NULL)
+        {
+            tcache->pool_next->pool_prev = tcache->pool_prev;
+        }
+        atomic_store(&tcache->registered, 0);
+        _mem_spin_unlock(&tcache->pool_mgr->tcaches_lock);
+    }
+    _mem_spin_unlock(&tcache_registry_lock);
+}
+
+// cut the blocks past the keep most recent ones off a bin, the caller
+// holds the bin's lock
+static node_pt _mem_tcache_detach(tcache_bin_pt bin, unsigned keep, unsigned *count)
+{
+    if(bin->count <= keep)
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    node_pt *link = &bin->head;
+    for(unsigned i = 0; i < keep; i++)
+    {
+        link = &(*link)->quick_next;
+    }
+
+    node_pt chain = *link;
+    *link = NULL;
+    *count = bin->count - keep;
+    bin->count = keep;
+
+    return chain;
+}
+
+// free a chain of cached blocks in the pool
+// note: one trip to the pool (and its lock) for the whole chain
+static void _mem_tcache_give_back(pool_mgr_pt pool_mgr, node_pt chain)
+{
+    if(chain == NULL)
+    {
+        return;
+    }
+
+    _mem_lock(pool_mgr);
+    while(chain != NULL)
+    {
+        node_pt next = chain->quick_next;
+
+        chain->quick_next = NULL;
+        chain->cached = 0;
+        _mem_del_alloc(pool_mgr, chain);
+
+        chain = next;
+    }
+    _mem_unlock(pool_mgr);
+}
+
+// take up to a batch of blocks of a size class from the depot
+static node_pt _mem_depot_take(pool_mgr_pt pool_mgr, unsigned bin_ix, unsigned *count)
+{
+    node_pt chain = NULL;
+
+    _mem_spin_lock(&pool_mgr->depot_lock);
+    if(pool_mgr->depot != NULL)
+    {
+        tcache_bin_pt bin = &pool_mgr->depot[bin_ix];
+
+        unsigned keep = bin->count > MEM_TCACHE_BATCH ? bin->count - MEM_TCACHE_BATCH : 0;
+
+        // the batch is the older end of the bin
+        chain = _mem_tcache_detach(bin, keep, count);
+    }
+    _mem_spin_unlock(&pool_mgr->depot_lock);
+
+    return chain;
+}
+
+// add a chain of blocks of a size class to the depot, what doesn't fit
+// is handed back
+static node_pt _mem_depot_put(pool_mgr_pt pool_mgr, unsigned bin_ix,
+                              node_pt chain, unsigned count)
+{
+    _mem_spin_lock(&pool_mgr->depot_lock);
+    if(pool_mgr->depot != NULL
+       && pool_mgr->depot[bin_ix].count + count <= MEM_TCACHE_DEPOT_MAX)
+    {
+        tcache_bin_pt bin = &pool_mgr->depot[bin_ix];
+        node_pt tail = chain;
+
+        while(tail->quick_next != NULL)
+        {
+            tail = tail->quick_next;
+        }
+        tail->quick_next = bin->head;
+        bin->head = chain;
+        bin->count += count;
+        chain = NULL;
+    }
+    _mem_spin_unlock(&pool_mgr->depot_lock);
+
+    return chain;
+}
+
+// give back all of the depot's blocks to the pool
+static void _mem_depot_release(pool_mgr_pt pool_mgr)
+{
+    node_pt chain = NULL;
+
+    _mem_spin_lock(&pool_mgr->depot_lock);
+    for(unsigned i = 0; pool_mgr->depot != NULL && i < MEM_TCACHE_BINS; i++)
+    {
+        tcache_bin_pt bin = &pool_mgr->depot[i];
+
+        while(bin->head != NULL)
+        {
+            node_pt node = bin->head;
+
+            bin->head = node->quick_next;
+            node->quick_next = chain;
+            chain = node;
+        }
+        bin->count = 0;
+    }
+    _mem_spin_unlock(&pool_mgr->depot_lock);
+
+    _mem_tcache_give_back(pool_mgr, chain);
+}
+
+// take the older half of a size class from another thread's cache of the
+// pool, skipping any cache that is busy
+// note: only the pool's own list lock is taken, so pools don't contend
+static node_pt _mem_tcache_steal(tcache_pt tcache, unsigned bin_ix, unsigned *count)
+{
+    pool_mgr_pt pool_mgr = tcache->pool_mgr;
+    node_pt chain = NULL;
+
+    _mem_spin_lock(&pool_mgr->tcaches_lock);
+    for(tcache_pt victim = pool_mgr->tcaches; victim != NULL && chain == NULL;
+        victim = victim->pool_next)
+    {
+        if(victim == tcache || ! _mem_spin_trylock(&victim->lock))
+        {
+            continue;
+        }
+
+        tcache_bin_pt bin = &victim->bins[bin_ix];
+        chain = _mem_tcache_detach(bin, bin->count / 2, count);
+        _mem_spin_unlock(&victim->lock);
+    }
+    _mem_spin_unlock(&pool_mgr->tcaches_lock);
+
+    return chain;
+}
+
+// allocate in the sufficient gap closest to the neighbour
+static void * _mem_new_alloc_near(pool_mgr_pt pool_mgr, size_t size, node_pt near_node)
+{
+    // without a neighbour, this is a regular allocation
+    if(near_node == NULL)
+    {
+        return _mem_new_alloc(pool_mgr, size, MEM_HINT_NONE);
+    }
+
+    // make sure the neighbour is an allocation from this pool
+    if(! _mem_is_heap_node(pool_mgr, near_node)
+       || near_node->used == 0 || near_node->allocated == 0)
+    {
+        return NULL;
+    }
+
+    // check if any gaps, return null if none
+    if(pool_mgr->pool.num_gaps == 0 || size == 0)
+    {
+        return NULL;
+    }
+    // a request too large for the pool can't wrap around below
+    size = _mem_request_size(pool_mgr, size);
+    if(size == 0 || size > pool_mgr->pool.total_size)
+    {
+        return NULL;
+    }
+
+    // expand heap node, if necessary, quit on error
+    if(_mem_resize_node_heap(pool_mgr, MEM_NODE_HEAP_FILL_FACTOR) != ALLOC_OK)
+    {
+        return NULL;
+    }
+
+    // walk outward from the neighbour in address order, always stepping
+    // on the side that is closer (in bytes), until a sufficient gap is found
+    // note: no cache coloring here, the slack would push the two apart
+    char *near_start = near_node->alloc_record.mem;
+    char *near_end = near_start + near_node->alloc_record.size;
+    node_pt before = near_node->prev;
+    node_pt after = near_node->next;
+
+    while(before != NULL || after != NULL)
+    {
+        size_t before_dist = before ? (size_t)(near_start - (before->alloc_record.mem
+                                                            + before->alloc_record.size))
+                                    : (size_t)-1;
+        size_t after_dist = after ? (size_t)(after->alloc_record.mem - near_end)
+                                  : (size_t)-1;
+
+        if(before_dist <= after_dist)
+        {
+            // a gap before the neighbour is cut off its high end
+            if(before->allocated == 0 && before->quick == 0)
+            {
+                size_t offset = _mem_alloc_offset(pool_mgr, before, size, 0, 1);
+                if(offset != MEM_NO_FIT)
+                {
+                    return (alloc_pt)_mem_split_gap(pool_mgr, before, offset, size);
+                }
+            }
+            before = before->prev;
+        }
+        else
+        {
+            // a gap after the neighbour is cut off its low end
+            if(after->allocated == 0 && after->quick == 0)
+            {
+                size_t offset = _mem_alloc_offset(pool_mgr, after, size, 0, 0);
+                if(offset != MEM_NO_FIT)
+                {
+                    return (alloc_pt)_mem_split_gap(pool_mgr, after, offset, size);
+                }
+            }
+            after = after->next;
+        }
+    }
+
+    return NULL;
+}
+
+static alloc_status _mem_set_quick_lists(pool_mgr_pt pool_mgr, unsigned threshold)
+{
+    // threshold 0 turns deferred coalescing off
+    if(threshold == 0)
+    {
+        alloc_status result = _mem_consolidate(pool_mgr);
+        if(result != ALLOC_OK)
+        {
+            return result;
+        }
+
+        free(pool_mgr->quick_lists);
+        pool_mgr->quick_lists = NULL;
+        pool_mgr->quick_threshold = 0;
+
+        return ALLOC_OK;
+    }
+
+    // allocate the quick list buckets on first use
+    if(pool_mgr->quick_lists == NULL)
     {
-        //   remove the next node from gap index
-        //   check success
-        _mem_remove_from_gap_ix(pool_mgr, node->next->alloc_record.size, node->next);
-        //   add the size to the node-to-delete
-        node->alloc_record.size += node->next->alloc_record.size;
-        //   update node as unused
-        node->next->used = 0;
-        //   update metadata (used nodes)
-        // pool_mgr->used_nodes -= 1;
+        pool_mgr->quick_lists =
+                (quick_list_pt) calloc(MEM_QUICK_LIST_BUCKETS, sizeof(quick_list_t));
+        if(pool_mgr->quick_lists == NULL)
+        {
+            return ALLOC_FAIL;
+        }
+    }
+    pool_mgr->quick_threshold = threshold;
+
+    // the new threshold might already be exceeded
+    if(pool_mgr->num_quick > pool_mgr->quick_threshold)
+    {
+        return _mem_consolidate(pool_mgr);
+    }
+
+    return ALLOC_OK;
+}
+
+// empty the quick lists into the gap index
+static alloc_status _mem_consolidate(pool_mgr_pt pool_mgr)
+{
+    if(pool_mgr->quick_lists == NULL)
+    {
+        return ALLOC_OK;
+    }
+
+    // empty every bucket, releasing its nodes to the gap index
+    // note: a neighbour still parked on a quick list is not merged with,
+    //       it merges in turn when its own bucket is emptied
+    for(unsigned i = 0; i < MEM_QUICK_LIST_BUCKETS; i++)
+    {
+        while(pool_mgr->quick_lists[i].head != NULL)
+        {
+            node_pt node = pool_mgr->quick_lists[i].head;
+            pool_mgr->quick_lists[i].head = node->quick_next;
+
+            node->quick = 0;
+            node->quick_next = NULL;
+            pool_mgr->num_quick -= 1;
+            pool_mgr->pool.num_gaps -= 1;
+
+            if(_mem_release_node(pool_mgr, node) != ALLOC_OK)
+            {
+                return ALLOC_FAIL;
+            }
+        }
+        pool_mgr->quick_lists[i].size = 0;
+    }
+
+    return ALLOC_OK;
+}
+
+// a monotonic clock where there is one
+static unsigned long long _mem_now_ns()
+{
+    struct timespec ts;
+
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// a mutex, or a spinlock that yields to other threads after spinning for
+// a while (for short critical sections), or nothing for a private pool
+// note: keeps the lock stats of the pool, only the acquisitions that find
+//       the lock taken are timed, and the hold time with MEM_POOL_LOCK_STATS
+static void _mem_lock(pool_mgr_pt pool_mgr)
+{
+    if(! (pool_mgr->flags & MEM_POOL_SHARED))
+    {
+        return;
+    }
+
+    unsigned long long wait_start = 0;
+    if(! (pool_mgr->flags & MEM_POOL_SPIN))
+    {
+        if(mtx_trylock(&pool_mgr->lock) != thrd_success)
+        {
+            wait_start = _mem_now_ns();
+            mtx_lock(&pool_mgr->lock);
+        }
+    }
+    else if(! _mem_spin_trylock(&pool_mgr->spin_lock))
+    {
+        wait_start = _mem_now_ns();
+        _mem_spin_lock(&pool_mgr->spin_lock);
+    }
+
+    unsigned long long now = 0;
+    if(wait_start != 0 || (pool_mgr->flags & MEM_POOL_LOCK_STATS))
+    {
+        now = _mem_now_ns();
+    }
+    pool_mgr->lock_acquisitions += 1;
+    if(wait_start != 0)
+    {
+        pool_mgr->lock_contended += 1;
+        pool_mgr->lock_wait_ns += now > wait_start ? now - wait_start : 0;
+    }
+    pool_mgr->lock_acquired_ns = now;
+
+    // snapshot readers retry while the count is odd, or if it changed
+    atomic_fetch_add_explicit(&pool_mgr->snapshot_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void _mem_unlock(pool_mgr_pt pool_mgr)
+{
+    if(! (pool_mgr->flags & MEM_POOL_SHARED))
+    {
+        return;
+    }
+
+    if(pool_mgr->flags & MEM_POOL_LOCK_STATS)
+    {
+        unsigned long long now = _mem_now_ns();
+        if(now > pool_mgr->lock_acquired_ns
+           && now - pool_mgr->lock_acquired_ns > pool_mgr->lock_max_hold_ns)
+        {
+            pool_mgr->lock_max_hold_ns = now - pool_mgr->lock_acquired_ns;
+        }
+    }
+    if(pool_mgr->laned != NULL)
+    {
+        _mem_lane_publish(pool_mgr);
+    }
+    atomic_fetch_add_explicit(&pool_mgr->snapshot_seq, 1, memory_order_release);
+
+    if(! (pool_mgr->flags & MEM_POOL_SPIN))
+    {
+        mtx_unlock(&pool_mgr->lock);
+        return;
+    }
+
+    _mem_spin_unlock(&pool_mgr->spin_lock);
+}
+
+static void _mem_spin_lock(atomic_int *lock)
+{
+    for(unsigned spins = 1; ; spins++)
+    {
+        // test before test-and-set, so waiters spin on a shared cache line
+        if(atomic_load_explicit(lock, memory_order_relaxed) == 0
+           && atomic_exchange_explicit(lock, 1, memory_order_acquire) == 0)
+        {
+            return;
+        }
+        if(spins % MEM_SPIN_LIMIT == 0)
+        {
+            thrd_yield();
+        }
+    }
+}
+
+static int _mem_spin_trylock(atomic_int *lock)
+{
+    return atomic_load_explicit(lock, memory_order_relaxed) == 0
+           && atomic_exchange_explicit(lock, 1, memory_order_acquire) == 0;
+}
+
+static void _mem_spin_unlock(atomic_int *lock)
+{
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+// give the last node block back, if none of its nodes is in use and the
+// rest of the heap has ample room
+static void _mem_trim_node_heap(pool_mgr_pt pool_mgr)
+{
+    unsigned last = atomic_load(&pool_mgr->num_node_blocks) - 1;
+    if(last == 0)
+    {
+        return;
+    }
+
+    node_pt nodes = pool_mgr->node_blocks[last].nodes;
+    unsigned capacity = pool_mgr->node_blocks[last].capacity;
+    if(pool_mgr->used_nodes > (pool_mgr->total_nodes - capacity) * MEM_NODE_HEAP_TRIM_FACTOR)
+    {
+        return;
+    }
+    for(unsigned i = 0; i < capacity; i++)
+    {
+        if(nodes[i].used)
+        {
+            return;
+        }
+    }
+
+    // a snapshot reader may be in the block, unless it came after this
+    atomic_fetch_sub(&pool_mgr->num_node_blocks, 1);
+    if(atomic_load(&pool_mgr->snapshot_readers) != 0)
+    {
+        atomic_fetch_add(&pool_mgr->num_node_blocks, 1);
+        return;
+    }
+
+    // take its nodes off the unused stack
+    for(node_pt *link = &pool_mgr->unused_nodes; *link != NULL; )
+    {
+        if(*link >= nodes && *link < nodes + capacity)
+        {
+            _mem_store_node(link, (*link)->next);
+        }
+        else
+        {
+            link = &(*link)->next;
+        }
+    }
+    pool_mgr->node_blocks[last].nodes = NULL;
+    pool_mgr->node_blocks[last].capacity = 0;
+    pool_mgr->total_nodes -= capacity;
+    free(nodes);
+}
+
+// halve the gap index (and its hash) while it's mostly empty
+static void _mem_trim_gap_ix(pool_mgr_pt pool_mgr)
+{
+    unsigned new_capacity = pool_mgr->gap_ix_capacity / MEM_GAP_IX_EXPAND_FACTOR;
+
+    if(new_capacity < MEM_GAP_IX_INIT_CAPACITY
+       || pool_mgr->gap_ix_size > pool_mgr->gap_ix_capacity * MEM_GAP_IX_TRIM_FACTOR)
+    {
+        return;
+    }
+
+    // the hash first (updates the capacity), on failure nothing is trimmed
+    if(_mem_rehash_gap_ix(pool_mgr, new_capacity) != ALLOC_OK)
+    {
+        return;
+    }
+
+    // if the index doesn't shrink, it just has room to spare
+    gap_pt new_gap_ix = realloc(pool_mgr->gap_ix, new_capacity * sizeof(gap_t));
+    if(new_gap_ix != NULL)
+    {
+        pool_mgr->gap_ix = new_gap_ix;
+    }
+}
+
+// give the whole pages inside large gaps back to the OS, they come back
+// zeroed on the next touch
+static void _mem_purge_gaps(pool_mgr_pt pool_mgr)
+{
+#ifdef __linux__
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    for(unsigned i = 0; i <= pool_mgr->gap_ix_size; i++)
+    {
+        node_pt node = i < pool_mgr->gap_ix_size ? pool_mgr->gap_ix[i].node : pool_mgr->top_node;
+        if(node == NULL || node->alloc_record.size < MEM_PURGE_MIN_GAP)
+        {
+            continue;
+        }
+
+        uintptr_t start = ((uintptr_t) node->alloc_record.mem + page - 1) / page * page;
+        uintptr_t end = ((uintptr_t) node->alloc_record.mem + node->alloc_record.size) / page * page;
+        if(end > start)
+        {
+            madvise((void *) start, end - start, MADV_DONTNEED);
+        }
+    }
+#else
+    (void) pool_mgr;
+#endif
+}
+
+// the deferrable upkeep of a pool, under its lock: merge the quick lists,
+// grow the node heap and the gap index ahead of need (or trim them), and
+// purge the gaps of a pool that has been idle since the last pass
+static void _mem_maintain_pool(pool_mgr_pt pool_mgr)
+{
+    _mem_lock(pool_mgr);
+
+    if(pool_mgr->num_quick > 0)
+    {
+        _mem_consolidate(pool_mgr);
+    }
+
+    _mem_resize_node_heap(pool_mgr, MEM_MAINTENANCE_FILL_FACTOR);
+    _mem_resize_gap_ix(pool_mgr, MEM_MAINTENANCE_FILL_FACTOR);
+    _mem_trim_node_heap(pool_mgr);
+    _mem_trim_gap_ix(pool_mgr);
+
+    if(pool_mgr->pool.alloc_size != pool_mgr->idle_alloc_size
+       || pool_mgr->pool.num_allocs != pool_mgr->idle_num_allocs)
+    {
+        pool_mgr->idle_alloc_size = pool_mgr->pool.alloc_size;
+        pool_mgr->idle_num_allocs = pool_mgr->pool.num_allocs;
+        pool_mgr->purged = 0;
+    }
+    else if(! pool_mgr->purged)
+    {
+        _mem_purge_gaps(pool_mgr);
+        pool_mgr->purged = 1;
+    }
+
+    _mem_unlock(pool_mgr);
+}
+
+// a maintenance pass over the pools that have a lock (and the lanes of
+// laned pools), the caller holds the maintenance lock
+// note: pools without a lock belong to one thread, they aren't touched
+static void _mem_maintain_store()
+{
+    unsigned size = atomic_load(&pool_store_size);
+
+    for(unsigned i = 0; i < size; i++)
+    {
+        pool_slot_pt slot = _mem_pool_store_slot(i, 0);
+        pool_mgr_pt pool_mgr = slot != NULL ? atomic_load(&slot->pool_mgr) : NULL;
+        if(pool_mgr == NULL)
+        {
+            continue;
+        }
+
+        for(unsigned j = 0; j < pool_mgr->num_lanes; j++)
+        {
+            _mem_maintain_pool(pool_mgr->lanes[j]);
+        }
+        if((pool_mgr->flags & (MEM_POOL_SHARED | MEM_POOL_SPIN))
+           && ! (pool_mgr->flags & MEM_POOL_NO_NODES))
+        {
+            _mem_maintain_pool(pool_mgr);
+        }
+    }
+}
+
+// note: a pass every MEM_MAINTENANCE_PERIOD_MS, until mem_free
+static int _mem_maintenance_thread(void *arg)
+{
+    (void) arg;
+
+    mtx_lock(&maintenance_lock);
+    while(! maintenance_stop)
+    {
+        struct timespec until;
+        timespec_get(&until, TIME_UTC);
+        until.tv_nsec += (long) MEM_MAINTENANCE_PERIOD_MS * 1000000;
+        until.tv_sec += until.tv_nsec / 1000000000;
+        until.tv_nsec %= 1000000000;
+
+        if(cnd_timedwait(&maintenance_wakeup, &maintenance_lock, &until) != thrd_success
+           && ! maintenance_stop)
+        {
+            _mem_maintain_store();
+        }
+    }
+    mtx_unlock(&maintenance_lock);
+
+    return 0;
+}
+
+// take a pool that is being closed out of the pool store, and wait out
+// a maintenance pass that may be working on it
+static void _mem_unpublish_pool(pool_mgr_pt pool_mgr)
+{
+    if(! (pool_mgr->flags & MEM_POOL_LANE))
+    {
+        _mem_publish_pool_store_slot(_mem_pool_store_slot(pool_mgr->store_ix, 0), NULL);
+    }
+
+    mtx_lock(&maintenance_lock);
+    mtx_unlock(&maintenance_lock);
+}
+
+// wake the allocations waiting on the pool, if a block of the size may do
+// note: may be called under the pool lock, the waiters never take it while
+//       holding the wait lock
+static void _mem_wake_waiters(pool_mgr_pt pool_mgr, size_t size)
+{
+    // the waiters of a lane wait on its pool
+    if(pool_mgr->laned != NULL)
+    {
+        pool_mgr = pool_mgr->laned;
+    }
+
+    if(atomic_load(&pool_mgr->waiters) == 0 || size < atomic_load(&pool_mgr->wait_size))
+    {
+        return;
+    }
+
+    atomic_fetch_add(&pool_mgr->free_gen, 1);
+
+    mtx_lock(&alloc_wait_lock);
+    cnd_broadcast(&alloc_wait_cond);
+    mtx_unlock(&alloc_wait_lock);
+}
+
+// close pools on up to num_threads threads, the caller being one of them
+// note: a close gives back the closing thread's cached blocks only, so the
+//       caller gives back its own first, and closes the owned pools itself
+static alloc_status _mem_close_pools(pool_pt *pools, unsigned num_pools, unsigned num_threads)
+{
+    close_job_t job = {.pools = pools, .num_pools = num_pools, .owned = NULL};
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, 0);
+
+    job.owned = (unsigned char*) calloc(num_pools ? num_pools : 1, sizeof(unsigned char));
+    if(job.owned == NULL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    for(unsigned i = 0; i < num_pools; i++)
+    {
+        pool_mgr_pt pool_mgr = (pool_mgr_pt)pools[i];
+
+        job.owned[i] = (pool_mgr->flags & MEM_POOL_OWNED) != 0;
+
+        for(unsigned j = 0; j < pool_mgr->num_lanes; j++)
+        {
+            _mem_tcache_release(pool_mgr->lanes[j]);
+        }
+        _mem_tcache_release(pool_mgr);
+    }
+
+    // no more threads than pools, nor than MEM_CLOSE_THREADS_MAX
+    if(num_threads > num_pools)
+    {
+        num_threads = num_pools;
+    }
+    if(num_threads > MEM_CLOSE_THREADS_MAX)
+    {
+        num_threads = MEM_CLOSE_THREADS_MAX;
+    }
+
+    // the caller works too, so it gets done even without extra threads
+    thrd_t *threads = (thrd_t*) calloc(num_threads ? num_threads : 1, sizeof(thrd_t));
+    unsigned num_started = 0;
+    while(threads != NULL && num_started + 1 < num_threads
+          && thrd_create(&threads[num_started], _mem_close_worker, &job) == thrd_success)
+    {
+        num_started += 1;
+    }
+    _mem_close_worker(&job);
+    for(unsigned i = 0; i < num_started; i++)
+    {
+        thrd_join(threads[i], NULL);
+    }
+    free(threads);
+
+    for(unsigned i = 0; i < num_pools; i++)
+    {
+        if(job.owned[i] && mem_pool_close(pools[i]) != ALLOC_OK)
+        {
+            atomic_fetch_add(&job.failed, 1);
+        }
+    }
+    free(job.owned);
+
+    return atomic_load(&job.failed) == 0 ? ALLOC_OK : ALLOC_NOT_FREED;
+}
+
+// take the next pool of the job and close it, until none is left
+static int _mem_close_worker(void *job)
+{
+    close_job_pt close_job = (close_job_pt) job;
+
+    for(;;)
+    {
+        unsigned i = atomic_fetch_add(&close_job->next, 1);
+        if(i >= close_job->num_pools)
+        {
+            return 0;
+        }
+
+        if(! close_job->owned[i] && mem_pool_close(close_job->pools[i]) != ALLOC_OK)
+        {
+            atomic_fetch_add(&close_job->failed, 1);
+        }
+    }
+}
+
+// relaxed atomic stores and loads of the fields that snapshot readers
+// walk without the lock (the node links, sizes and allocated flags, and
+// the used node count); the writers hold the lock, so they read plainly
+// note: the fields are plain (alloc_record is public), so these are the
+//       compiler's atomic builtins rather than C11 atomic types
+static void _mem_store_node(node_pt *field, node_pt value)
+{
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+static void _mem_store_size(size_t *field, size_t value)
+{
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+static void _mem_store_unsigned(unsigned *field, unsigned value)
+{
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+static node_pt _mem_load_node(node_pt *field)
+{
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+static size_t _mem_load_size(size_t *field)
+{
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+static unsigned _mem_load_unsigned(unsigned *field)
+{
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+// copy the segments in address order, as many as fit, and return how
+// many were copied, or capacity + 1 if there were more
+// note: read between writers, the links may be torn, so the walk stays
+//       within the node blocks and stops at capacity
+static unsigned _mem_read_segments(pool_mgr_pt pool_mgr,
+                                   pool_segment_pt segments, unsigned capacity)
+{
+    unsigned seg = 0;
 
-        //   update linked list:
-        node_pt temp = node->next;
-        //if (next->next) {
-        if(temp->next)
-        {
-            //next->next->prev = node_to_del;
-            temp->next->prev = node;
-            //node_to_del->next = next->next;
-            node->next = temp->next;
-        }
-        else
+    for(node_pt node = pool_mgr->node_heap; node != NULL; node = _mem_load_node(&node->next))
+    {
+        if(seg == capacity || ! _mem_is_heap_node(pool_mgr, node))
         {
-            node->next = NULL;
+            return capacity + 1;
         }
-        //next->next = NULL;
-        temp->next = NULL;
-        //next->prev = NULL;
-        temp->prev = NULL;
-
-        // this merged node-to-delete might need to be added to the gap index
-        // but one more thing to check...
+        segments[seg].size = _mem_load_size(&node->alloc_record.size);
+        segments[seg].allocated = _mem_load_unsigned(&node->allocated);
+        seg++;
     }
-    // if the previous node in the list is also a gap, merge into previous!
-    if(node->prev != NULL && node->prev->allocated == 0)
-    {
-        //   remove the previous node from gap index
-        //   check success
-        _mem_remove_from_gap_ix(pool_mgr, node->prev->alloc_record.size, node->prev);
 
-        //   add the size of node-to-delete to the previous
-        node->prev->alloc_record.size += node->alloc_record.size;
-        //   update node-to-delete as unused
-        node->used = 0;
-        //   update metadata (used nodes)
-        //pool_mgr->used_nodes -= 1;
-
-        node_pt temp = node->prev;
-        //if (node_to_del->next) {
-        if(node->next)
-        {
-            //prev->next = node_to_del->next;
-            temp->next = node->next;
-            //node_to_del->next->prev = prev;
-            node->next->prev = temp;
-        }
-        else
+    return seg;
+}
+
+// a consistent segment listing of a pool (not laned), taking the lock
+// only if writers keep getting in the way
+static alloc_status _mem_snapshot_segments(pool_mgr_pt pool_mgr, pool_segment_pt segments,
+                                           unsigned capacity, unsigned *num_segments)
+{
+    unsigned seg = capacity + 1;
+    unsigned used_nodes = 0;
+    unsigned done = 0;
+
+    if(pool_mgr->flags & MEM_POOL_SHARED)
+    {
+        atomic_fetch_add(&pool_mgr->snapshot_readers, 1);
+        for(unsigned i = 0; i < MEM_SNAPSHOT_RETRIES && ! done; i++)
         {
-            //prev->next = NULL;
-            temp->next = NULL;
-        }
+            unsigned seq = atomic_load_explicit(&pool_mgr->snapshot_seq, memory_order_acquire);
+            if(seq & 1)
+            {
+                thrd_yield();
+                continue;
+            }
 
-        //node_to_del->next = NULL;
-        node->next = NULL;
-        //node_to_del->prev = NULL;
-        node->prev = NULL;
+            used_nodes = _mem_load_unsigned(&pool_mgr->used_nodes);
+            seg = _mem_read_segments(pool_mgr, segments, capacity);
 
-        // change the node to add to the previous node!
-        node = temp;
+            // the loads above come before the check
+            atomic_thread_fence(memory_order_acquire);
+            done = atomic_load_explicit(&pool_mgr->snapshot_seq, memory_order_relaxed) == seq;
+        }
+        atomic_fetch_sub(&pool_mgr->snapshot_readers, 1);
     }
 
-    // add the resulting node to the gap index
-    alloc_status result = _mem_add_to_gap_ix(pool_mgr, node->alloc_record.size, node);
-    // check success
-    if(result != ALLOC_OK)
+    // a pool without a lock is the caller's own, or the writers won
+    if(! done)
     {
-        return ALLOC_FAIL;
+        _mem_lock(pool_mgr);
+        used_nodes = pool_mgr->used_nodes;
+        seg = _mem_read_segments(pool_mgr, segments, capacity);
+        _mem_unlock(pool_mgr);
     }
 
-    //   update metadata (used_nodes)
-    pool_mgr->used_nodes -= 1;
+    if(seg > capacity)
+    {
+        *num_segments = used_nodes;
+        return ALLOC_FAIL;
+    }
 
+    *num_segments = seg;
     return ALLOC_OK;
 }
 
-void mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments) {
-    // get the mgr from the pool
-    pool_mgr_pt pool_mgr = (pool_mgr_pt)pool;
+static int _mem_is_owner(pool_mgr_pt pool_mgr)
+{
+    return ! (pool_mgr->flags & MEM_POOL_OWNED)
+           || thrd_equal(thrd_current(), pool_mgr->owner);
+}
 
-    node_pt temp = pool_mgr->node_heap;
-    // allocate the segments array with size == used_nodes
-    // NEED TO FREE LATER
-    pool_segment_pt seg_array = (pool_segment_pt) calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
-    // check successful
-    if(seg_array == NULL)
+// push a block freed by another thread onto the owner's remote free stack,
+// the caller has claimed its remote flag
+// note: many threads push, only the owner takes (all of) the stack, so
+//       there is no ABA problem with a plain compare-and-swap
+static void _mem_push_remote_free(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node_pt head = atomic_load_explicit(&pool_mgr->remote_frees, memory_order_relaxed);
+
+    do
+    {
+        node->remote_next = head;
+    } while(! atomic_compare_exchange_weak_explicit(&pool_mgr->remote_frees, &head, node,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+// take the remote free stack and free its blocks, owner only
+static void _mem_drain_remote_frees(pool_mgr_pt pool_mgr)
+{
+    // cheap check first, so an empty stack costs no atomic write
+    if(atomic_load_explicit(&pool_mgr->remote_frees, memory_order_relaxed) == NULL)
     {
         return;
     }
 
-    // loop through the node heap and the segments array
-    for(int i = 0; i < pool_mgr->used_nodes; i++)
+    node_pt node = atomic_exchange_explicit(&pool_mgr->remote_frees, NULL,
+                                            memory_order_acquire);
+    while(node != NULL)
     {
-        //    for each node, write the size and allocated in the segment
-        seg_array[i].size = temp->alloc_record.size;
-        seg_array[i].allocated = temp->allocated;
+        node_pt next = node->remote_next;
 
-        temp = temp->next;
+        node->remote_next = NULL;
+        atomic_store_explicit(&node->remote, 0, memory_order_relaxed);
+        _mem_del_alloc(pool_mgr, node);
+        node = next;
+    }
+}
 
+// this thread's reader record, claimed (or made) on first use if asked to
+static epoch_reader_pt _mem_get_epoch_reader(unsigned create)
+{
+    epoch_reader_pt reader = (epoch_reader_pt) tss_get(epoch_key);
+    if(reader != NULL || ! create)
+    {
+        return reader;
     }
 
-    // "return" the values:
-    *segments = seg_array;
-    *num_segments = pool_mgr->used_nodes;
+    // reuse a record given up by a thread that exited
+    for(reader = atomic_load(&epoch_readers); reader != NULL; reader = reader->next)
+    {
+        int free_record = 0;
+        if(atomic_compare_exchange_strong(&reader->in_use, &free_record, 1))
+        {
+            break;
+        }
+    }
+
+    if(reader == NULL)
+    {
+        reader = (epoch_reader_pt) calloc(1, sizeof(epoch_reader_t));
+        if(reader == NULL)
+        {
+            return NULL;
+        }
+        atomic_init(&reader->epoch, 0);
+        atomic_init(&reader->active, 0);
+        atomic_init(&reader->in_use, 1);
+
+        epoch_reader_pt head = atomic_load(&epoch_readers);
+        do
+        {
+            reader->next = head;
+        } while(! atomic_compare_exchange_weak(&epoch_readers, &head, reader));
+    }
+
+    reader->depth = 0;
+    if(tss_set(epoch_key, reader) != thrd_success)
+    {
+        atomic_store(&reader->in_use, 0);
+        return NULL;
+    }
+
+    return reader;
 }
 
+// note: the tss destructor, so it runs at thread exit
+static void _mem_epoch_release(void *reader)
+{
+    epoch_reader_pt epoch_reader = (epoch_reader_pt) reader;
 
+    epoch_reader->depth = 0;
+    atomic_store(&epoch_reader->active, 0);
+    atomic_store_explicit(&epoch_reader->in_use, 0, memory_order_release);
+}
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store()
+// move the global epoch on if every thread inside an epoch has seen it,
+// and return it
+static unsigned _mem_epoch_try_advance()
 {
-    // check if necessary
-    if (((float)pool_store_size / pool_store_capacity) > MEM_POOL_STORE_FILL_FACTOR)
-    {
-        // Get new size
-        unsigned new_size = MEM_POOL_STORE_INIT_CAPACITY * MEM_POOL_STORE_EXPAND_FACTOR;
+    unsigned epoch = atomic_load(&mem_epoch);
 
-        // Call to reallocate the memory
-        pool_store = realloc(pool_store, new_size);
-        // CHeck if it fails
-        if(pool_store == NULL)
+    for(epoch_reader_pt reader = atomic_load(&epoch_readers); reader != NULL;
+        reader = reader->next)
+    {
+        if(atomic_load(&reader->active) && atomic_load(&reader->epoch) != epoch)
         {
-            return ALLOC_FAIL;
+            return epoch;
         }
-
-        // don't forget to update capacity variables
-        pool_store_capacity = new_size;
     }
 
-    return ALLOC_OK;
+    // whoever wins, the epoch has moved on
+    atomic_compare_exchange_strong(&mem_epoch, &epoch, epoch + 1);
+
+    return atomic_load(&mem_epoch);
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr)
+// push a chain of blocks onto the pool's deferred free stack
+// note: nothing ever pops a single block (reclaim takes all of the stack),
+//       so there is no ABA problem with a plain compare-and-swap
+static void _mem_push_deferred_frees(pool_mgr_pt pool_mgr, node_pt head, node_pt tail)
 {
-    // see above
-    if(((float)pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_NODE_HEAP_FILL_FACTOR)
+    node_pt top = atomic_load_explicit(&pool_mgr->deferred_frees, memory_order_relaxed);
+
+    do
     {
-        // Get new size
-        unsigned new_size = MEM_NODE_HEAP_INIT_CAPACITY * MEM_NODE_HEAP_EXPAND_FACTOR;
-        // Allocate new node
-        node_pt new_node_heap = calloc(new_size, sizeof(node_t));
-        // Check success
-        if(new_node_heap == NULL)
+        tail->deferred_next = top;
+    } while(! atomic_compare_exchange_weak_explicit(&pool_mgr->deferred_frees, &top, head,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+// free the deferred blocks that no reader can still see, that is, freed
+// two or more epochs ago, and put the rest back
+static void _mem_reclaim_deferred(pool_mgr_pt pool_mgr)
+{
+    // cheap check first, so an empty stack costs no atomic write
+    if(atomic_load_explicit(&pool_mgr->deferred_frees, memory_order_relaxed) == NULL)
+    {
+        return;
+    }
+
+    // an idle reader set lets the epoch move on twice in a row
+    _mem_epoch_try_advance();
+    unsigned epoch = _mem_epoch_try_advance();
+
+    node_pt node = atomic_exchange_explicit(&pool_mgr->deferred_frees, NULL,
+                                            memory_order_acquire);
+    node_pt safe = NULL;
+    node_pt keep_head = NULL, keep_tail = NULL;
+    while(node != NULL)
+    {
+        node_pt next = node->deferred_next;
+
+        if(epoch - node->deferred_epoch >= 2)
         {
-            return ALLOC_FAIL;
+            node->deferred_next = safe;
+            safe = node;
         }
-        // Call to invalidate the gap_ix
-        alloc_status result = _mem_invalidate_gap_ix(pool_mgr);
-        // Check success
-        if(result != ALLOC_OK)
+        else
         {
-            return ALLOC_FAIL;
+            node->deferred_next = keep_head;
+            keep_head = node;
+            if(keep_tail == NULL)
+            {
+                keep_tail = node;
+            }
         }
+        node = next;
+    }
 
-        // Traverse node heap
-        while(pool_mgr->node_heap != NULL)
-        {
-            // Copy over the memory to new node heap
-            memcpy(new_node_heap, pool_mgr->node_heap, sizeof(pool_mgr->node_heap));
+    if(keep_head != NULL)
+    {
+        _mem_push_deferred_frees(pool_mgr, keep_head, keep_tail);
+    }
 
-            //If its a gap_ix
-            if(pool_mgr->node_heap->allocated == 0)
-            {
-                alloc_status result =
-                        _mem_add_to_gap_ix(pool_mgr, pool_mgr->node_heap->alloc_record.size, pool_mgr->node_heap);
-                // Check success
-                if(result != ALLOC_OK)
-                {
-                    return ALLOC_FAIL;
-                }
-            }
+    // the owner of an owned pool takes in the rest as remote frees
+    if(! _mem_is_owner(pool_mgr))
+    {
+        while(safe != NULL)
+        {
+            node_pt next = safe->deferred_next;
 
-            pool_mgr->node_heap = pool_mgr->node_heap->next;
+            safe->deferred_next = NULL;
+            safe->deferred = 0;
+            _mem_push_remote_free(pool_mgr, safe);
+            safe = next;
         }
+        return;
+    }
+
+    _mem_lock(pool_mgr);
+    while(safe != NULL)
+    {
+        node_pt next = safe->deferred_next;
 
-        pool_mgr->node_heap = new_node_heap;
-        pool_mgr->total_nodes = new_size;
+        safe->deferred_next = NULL;
+        safe->deferred = 0;
+        _mem_del_alloc(pool_mgr, safe);
+        safe = next;
     }
+    _mem_unlock(pool_mgr);
+}
 
-    return ALLOC_OK;
+static int _mem_compare_pool_mem(const void *a, const void *b)
+{
+    char *mem_a = (*(const pool_pt*)a)->mem;
+    char *mem_b = (*(const pool_pt*)b)->mem;
+
+    return (mem_a > mem_b) - (mem_a < mem_b);
 }
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr)
+// the shard of the CPU the thread runs on, or (where the CPU isn't known)
+// a shard given to the thread on its first call, round robin
+static unsigned _mem_home_shard(unsigned num_shards)
 {
-    // see above
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if(cpu >= 0)
+    {
+        return (unsigned)cpu % num_shards;
+    }
+#endif
+
+    if(thread_shard == 0)
+    {
+        thread_shard = atomic_fetch_add(&group_threads, 1) + 1;
+    }
+
+    return (thread_shard - 1) % num_shards;
+}
 
-    if(((float)pool_mgr->used_nodes / pool_mgr->total_nodes) > MEM_GAP_IX_FILL_FACTOR)
+// the shard whose pool memory holds the allocation, if any
+static pool_pt _mem_group_find_shard(pool_group_mgr_pt group_mgr, alloc_pt alloc)
+{
+    if(alloc == NULL)
     {
-        unsigned new_size = MEM_GAP_IX_INIT_CAPACITY * MEM_GAP_IX_EXPAND_FACTOR;
+        return NULL;
+    }
 
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, new_size);
+    // the last shard starting at or below the address
+    unsigned low = 0;
+    unsigned high = group_mgr->group.num_shards;
+    while(low < high)
+    {
+        unsigned mid = low + (high - low) / 2;
 
-        if(pool_mgr->gap_ix == NULL)
+        if(group_mgr->shards_by_mem[mid]->mem <= alloc->mem)
         {
-            return ALLOC_FAIL;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
         }
+    }
+    if(low == 0)
+    {
+        return NULL;
+    }
 
-        pool_mgr->gap_ix_capacity = new_size;
+    pool_pt shard = group_mgr->shards_by_mem[low - 1];
+    if(alloc->mem >= shard->mem + shard->total_size)
+    {
+        return NULL;
     }
 
-    return ALLOC_OK;
+    return shard;
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node)
+// the lane whose node heap has the node, if any
+static pool_mgr_pt _mem_find_lane(pool_mgr_pt pool_mgr, node_pt node)
 {
-
-    // expand the gap index, if necessary (call the function)
-    alloc_status result = _mem_resize_gap_ix(pool_mgr);
-    if (result != ALLOC_OK)
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
     {
-        return ALLOC_FAIL;
+        if(_mem_is_heap_node(pool_mgr->lanes[i], node))
+        {
+            return pool_mgr->lanes[i];
+        }
     }
-    // add the entry at the end
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
 
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps += 1;
-    pool_mgr->used_nodes += 1;
+    return NULL;
+}
 
-    // sort the gap index (call the function)
-    result = _mem_sort_gap_ix(pool_mgr);
-    //assert(result == ALLOC_OK);
-    if (result != ALLOC_OK)
+// the lane of the current CPU first, then the others in turn, and last
+// the gaps that straddle a lane boundary
+// note: without a hint, through the lanes' thread caches (if on)
+static void * _mem_lanes_new_alloc(pool_mgr_pt pool_mgr, size_t size, alloc_hint hint)
+{
+    unsigned num_lanes = pool_mgr->num_lanes;
+    unsigned home = _mem_home_shard(num_lanes);
+
+    for(unsigned i = 0; i < num_lanes; i++)
     {
-        return ALLOC_FAIL;
+        pool_pt lane = (pool_pt)pool_mgr->lanes[(home + i) % num_lanes];
+        void * alloc = hint == MEM_HINT_NONE ? mem_new_alloc(lane, size)
+                                             : mem_new_alloc_hint(lane, size, hint);
+        if(alloc != NULL)
+        {
+            return alloc;
+        }
     }
 
-    // check success
+    for(unsigned i = 0; i + 1 < num_lanes; i++)
+    {
+        void * alloc = _mem_lanes_join(pool_mgr->lanes[i], pool_mgr->lanes[i + 1], size, hint);
+        if(alloc != NULL)
+        {
+            return alloc;
+        }
+    }
 
-    return result;
+    return NULL;
 }
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
-                                            size_t size,
-                                            node_pt node)
+// make the same setting on each lane, ALLOC_FAIL if any of them fails
+static alloc_status _mem_lanes_set(pool_mgr_pt pool_mgr,
+                                   alloc_status (*setter)(pool_pt, unsigned), unsigned value)
 {
+    alloc_status result = ALLOC_OK;
 
-    int test = 0;
-    // find the position of the node in the gap index
-    // loop from there to the end of the array:
-    //    pull the entries (i.e. copy over) one position up
-    //    this effectively deletes the chosen node
-    for(int i = 0; i < pool_mgr->used_nodes; i++)
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
     {
-        if (pool_mgr->gap_ix[i].node == node)
+        if(setter((pool_pt)pool_mgr->lanes[i], value) != ALLOC_OK)
         {
-            for(; i < pool_mgr->used_nodes; i++)
-            {
-                pool_mgr->gap_ix[i].size = pool_mgr->gap_ix[i + 1].size;
-                pool_mgr->gap_ix[i].node = pool_mgr->gap_ix[i + 1].node;
-            }
-
-            test = 1;
-
-            break;
+            result = ALLOC_FAIL;
         }
     }
 
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps -= 1;
-    pool_mgr->used_nodes -= 1;
-
-    // zero out the element at position num_gaps!
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = 0;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = NULL;
-
-    return ALLOC_OK;
+    return result;
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr)
+// move the boundary between two neighbouring lanes up, so that the leading
+// gap of the high lane joins the trailing gap of the low lane, and
+// allocate from the joined gap
+// note: locks the low lane first, like every other caller holding two; the
+//       high lane keeps the last bytes (up to a cache line) of its leading
+//       gap, so its first node (the start of its node heap) stays in place
+static void * _mem_lanes_join(pool_mgr_pt low, pool_mgr_pt high, size_t size, alloc_hint hint)
 {
-    // the new entry is at the end, so "bubble it up"
-    // loop from num_gaps - 1 until but not including 0:
+    void * alloc = NULL;
 
-    gap_t temp;
+    _mem_lock(low);
+    _mem_lock(high);
 
-    int i = pool_mgr->pool.num_gaps - 1;
+    node_pt top_node = low->top_node;
+    node_pt first_node = high->node_heap;
+    if(top_node == NULL || first_node->allocated || first_node->quick
+       || first_node->alloc_record.size <= MEM_CACHE_LINE)
+    {
+        _mem_unlock(high);
+        _mem_unlock(low);
+        return NULL;
+    }
 
-    for(; i > 0; i--)
+    size_t shift = (first_node->alloc_record.size - 1) / MEM_CACHE_LINE * MEM_CACHE_LINE;
+    size_t request_size = _mem_request_size(low, size);
+    if(request_size == 0 || top_node->alloc_record.size + shift < request_size)
     {
-        // if the size of the current entry is less than the previous (u - 1)
+        _mem_unlock(high);
+        _mem_unlock(low);
+        return NULL;
+    }
 
-        if(pool_mgr->gap_ix[i].size < pool_mgr->gap_ix[i - 1].size)
-        {
-            // swap them (by copying) (remember to use a temporary variable)
-            temp = pool_mgr->gap_ix[i];
+    //   the high lane gives up the front of its leading gap
+    _mem_remove_gap(high, first_node);
+    first_node->alloc_record.mem += shift;
+    _mem_store_size(&first_node->alloc_record.size, first_node->alloc_record.size - shift);
+    high->pool.mem += shift;
+    high->pool.total_size -= shift;
+    _mem_add_gap(high, first_node);
+    _mem_unlock(high);
+
+    //   and the low lane's top chunk grows by as much
+    _mem_remove_gap(low, top_node);
+    _mem_store_size(&top_node->alloc_record.size, top_node->alloc_record.size + shift);
+    low->pool.total_size += shift;
+    _mem_add_gap(low, top_node);
+    atomic_store(&low->lane_joined, 1);
+
+    alloc = _mem_new_alloc(low, size, hint);
+    _mem_unlock(low);
+
+    return alloc;
+}
 
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i - 1];
+// after a free in a lane, move the boundaries on either side of it back
+// towards where they were, as far as the gaps next to them allow
+static void _mem_lanes_give_back(pool_mgr_pt pool_mgr, pool_mgr_pt lane)
+{
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+    {
+        if(pool_mgr->lanes[i] != lane)
+        {
+            continue;
+        }
 
-            pool_mgr->gap_ix[i - 1] = temp;
+        if(i > 0 && atomic_load(&pool_mgr->lanes[i - 1]->lane_joined))
+        {
+            _mem_lanes_unjoin(pool_mgr->lanes[i - 1], lane);
         }
-        // or if the sizes are the same but the current entry points to a
-        // node with a lower address of pool allocation address (mem)
-        if(pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i - 1].size
-                && pool_mgr->gap_ix[i].node < pool_mgr->gap_ix[i - 1].node)
+        if(i + 1 < pool_mgr->num_lanes && atomic_load(&lane->lane_joined))
         {
-            // swap them (by copying) (remember to use a temporary variable)
-            temp = pool_mgr->gap_ix[i];
-
-            pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i - 1];
-
-            pool_mgr->gap_ix[i - 1] = temp;
+            _mem_lanes_unjoin(lane, pool_mgr->lanes[i + 1]);
         }
+        return;
     }
-    return ALLOC_OK;
 }
 
-static alloc_status _mem_invalidate_gap_ix(pool_mgr_pt pool_mgr)
+// move the boundary between two neighbouring lanes back down, so that the
+// high lane's leading gap gets back what the low lane's trailing gap took
+// note: locks the low lane first; the low lane keeps the first bytes (up
+//       to a cache line) of its trailing gap, so a boundary may only move
+//       part of the way back, and not at all while the high lane's first
+//       node is in use
+static void _mem_lanes_unjoin(pool_mgr_pt low, pool_mgr_pt high)
 {
+    _mem_lock(low);
+    _mem_lock(high);
+
+    node_pt top_node = low->top_node;
+    node_pt first_node = high->node_heap;
+    size_t excess = (size_t)(low->pool.mem + low->pool.total_size - low->lane_end);
+    if(excess == 0 || top_node == NULL || top_node->alloc_record.size <= MEM_CACHE_LINE
+       || first_node->allocated || first_node->quick)
+    {
+        _mem_unlock(high);
+        _mem_unlock(low);
+        return;
+    }
 
-    for(int i = 0; i < pool_mgr->used_nodes; i++)
+    size_t shift = top_node->alloc_record.size > excess ? excess
+                   : (top_node->alloc_record.size - 1) / MEM_CACHE_LINE * MEM_CACHE_LINE;
+
+    //   the low lane's top chunk gives up its back
+    _mem_remove_gap(low, top_node);
+    _mem_store_size(&top_node->alloc_record.size, top_node->alloc_record.size - shift);
+    low->pool.total_size -= shift;
+    _mem_add_gap(low, top_node);
+    if(shift == excess)
     {
-        pool_mgr->gap_ix[i].size = 0;
-        pool_mgr->gap_ix[i].node = NULL;
+        atomic_store(&low->lane_joined, 0);
     }
+    _mem_unlock(low);
+
+    //   and the high lane's leading gap grows by as much
+    _mem_remove_gap(high, first_node);
+    first_node->alloc_record.mem -= shift;
+    _mem_store_size(&first_node->alloc_record.size, first_node->alloc_record.size + shift);
+    high->pool.mem -= shift;
+    high->pool.total_size += shift;
+    _mem_add_gap(high, first_node);
+    _mem_unlock(high);
+}
 
-    return ALLOC_OK;
+// add what the lane's counters changed by since the last time to those of
+// its laned pool, with the lane locked (or not yet handed out)
+// note: the other lanes add theirs at the same time, a drop wraps around
+static void _mem_lane_publish(pool_mgr_pt lane)
+{
+    pool_pt laned = &lane->laned->pool;
+
+    __atomic_fetch_add(&laned->alloc_size,
+                       lane->pool.alloc_size - lane->laned_alloc_size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&laned->num_allocs,
+                       lane->pool.num_allocs - lane->laned_num_allocs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&laned->num_gaps,
+                       lane->pool.num_gaps - lane->laned_num_gaps, __ATOMIC_RELAXED);
+    lane->laned_alloc_size = lane->pool.alloc_size;
+    lane->laned_num_allocs = lane->pool.num_allocs;
+    lane->laned_num_gaps = lane->pool.num_gaps;
 }
 
+// the lanes' segments in address order
+static void _mem_inspect_lanes(pool_mgr_pt pool_mgr,
+                               pool_segment_pt *segments, unsigned *num_segments)
+{
+    unsigned used_nodes = 0;
+
+    for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+    {
+        _mem_lock(pool_mgr->lanes[i]);
+        used_nodes += pool_mgr->lanes[i]->used_nodes;
+    }
+
+    pool_segment_pt seg_array = (pool_segment_pt) calloc(used_nodes, sizeof(pool_segment_t));
+    if(seg_array != NULL)
+    {
+        unsigned seg = 0;
+
+        for(unsigned i = 0; i < pool_mgr->num_lanes; i++)
+        {
+            pool_mgr_pt lane = pool_mgr->lanes[i];
+
+            for(node_pt node = lane->node_heap; node != NULL; node = node->next)
+            {
+                seg_array[seg].size = node->alloc_record.size;
+                seg_array[seg].allocated = node->allocated;
+                seg++;
+            }
+        }
+
+        *segments = seg_array;
+        *num_segments = used_nodes;
+    }
+
+    for(unsigned i = pool_mgr->num_lanes; i > 0; i--)
+    {
+        _mem_unlock(pool_mgr->lanes[i - 1]);
+    }
+}
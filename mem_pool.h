@@ -7,7 +7,29 @@
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, GOOD_FIT } alloc_policy;
+
+typedef enum _alloc_hint { MEM_HINT_NONE, MEM_HINT_SHORT, MEM_HINT_LONG } alloc_hint;
+
+typedef enum _alloc_size_class {
+    MEM_SIZE_EXACT,
+    MEM_SIZE_STEP,
+    MEM_SIZE_GEOMETRIC
+} alloc_size_class;
+
+typedef enum _pool_flags {
+    MEM_POOL_SHARED = 0x1, // per-pool lock (a mutex)
+    MEM_POOL_SPIN   = 0x2, // per-pool lock (an adaptive spinlock)
+    MEM_POOL_OWNED  = 0x4, // no lock, other threads may only free
+    MEM_POOL_ARENA  = 0x8, // lock-free bump allocation, freed all at once
+    MEM_POOL_SLAB   = 0x10, // lock-free fixed-size objects (mem_pool_open_slab)
+    MEM_POOL_LANES  = 0x20, // address-range lanes, a lock each (mem_pool_open_lanes)
+    MEM_POOL_LOCK_STATS = 0x40 // also time how long the lock is held (max_hold_ns)
+} pool_flags;
+
+typedef enum _init_flags {
+    MEM_INIT_MAINTENANCE = 0x1 // a background thread does the pools' upkeep
+} init_flags;
 
 typedef struct _pool {
     char *mem;
@@ -18,11 +40,29 @@ typedef struct _pool {
     unsigned num_gaps;
 } pool_t, *pool_pt;
 
+typedef struct _alloc {
+    char *mem;
+    size_t size;
+} alloc_t, *alloc_pt;
+
+typedef struct _pool_group {
+    unsigned num_shards;
+    size_t shard_size;
+    alloc_policy policy;
+} pool_group_t, *pool_group_pt;
+
 typedef struct _pool_segment {
     size_t size;
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _pool_lock_stats {
+    unsigned long acquisitions;
+    unsigned long contended; // found the lock taken
+    unsigned long long wait_ns; // total, of the contended acquisitions
+    unsigned long long max_hold_ns; // MEM_POOL_LOCK_STATS only
+} pool_lock_stats_t, *pool_lock_stats_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -35,22 +75,131 @@ typedef enum _alloc_status {
 alloc_status
 mem_init();
 
+alloc_status
+mem_init_ex(unsigned flags);
+
 alloc_status
 mem_free();
 
+alloc_status
+mem_free_parallel(unsigned num_threads);
+
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_ex(size_t size, alloc_policy policy, unsigned flags);
+
+pool_pt
+mem_pool_open_slab(size_t size, size_t object_size);
+
+pool_pt
+mem_pool_open_lanes(size_t size, alloc_policy policy, unsigned num_lanes); // an allocation fits in two neighbouring lanes at most
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_close_many(pool_pt pools[], unsigned num_pools);
+
+pool_pt
+mem_pool_find(const void *mem);
+
 void *
 mem_new_alloc(pool_pt pool, size_t size);
 
+void *
+mem_new_alloc_hint(pool_pt pool, size_t size, alloc_hint hint);
+
+void *
+mem_new_alloc_near(pool_pt pool, size_t size, void *neighbor);
+
+void *
+mem_new_alloc_wait(pool_pt pool, size_t size, unsigned timeout_ms); // only shared and laned pools wait
+
 alloc_status
 mem_del_alloc(pool_pt pool, void *alloc);
 
+alloc_status
+mem_del_alloc_deferred(pool_pt pool, void *alloc);
+
+alloc_status
+mem_epoch_enter();
+
+alloc_status
+mem_epoch_exit();
+
+void *
+mem_arena_alloc(pool_pt pool, size_t size);
+
+alloc_status
+mem_arena_reset(pool_pt pool);
+
+void *
+mem_slab_alloc(pool_pt pool);
+
+alloc_status
+mem_slab_free(pool_pt pool, void *object);
+
+alloc_status
+mem_pool_set_tcache(pool_pt pool, unsigned enable);
+
+alloc_status
+mem_tcache_flush();
+
+alloc_status
+mem_pool_set_quick_lists(pool_pt pool, unsigned threshold);
+
+alloc_status
+mem_pool_consolidate(pool_pt pool);
+
+alloc_status
+mem_pool_lock_stats(pool_pt pool, pool_lock_stats_pt stats);
+
+alloc_status
+mem_maintain(); // locks each shared pool, private pools are skipped
+
+alloc_status
+mem_pool_set_search_limit(pool_pt pool, unsigned max_candidates);
+
+alloc_status
+mem_pool_set_policy(pool_pt pool, alloc_policy policy);
+
+alloc_status
+mem_pool_set_auto_policy(pool_pt pool, unsigned enable);
+
+alloc_status
+mem_pool_set_lifo_reuse(pool_pt pool, unsigned enable);
+
+alloc_status
+mem_pool_set_cache_align(pool_pt pool, unsigned enable);
+
+alloc_status
+mem_pool_set_cache_coloring(pool_pt pool, unsigned enable);
+
+alloc_status
+mem_pool_set_size_classes(pool_pt pool, alloc_size_class classes, size_t step);
+
+alloc_status
+mem_pool_set_min_split(pool_pt pool, size_t min_split);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+alloc_status
+mem_inspect_pool_snapshot(pool_pt pool, pool_segment_pt segments,
+                          unsigned capacity, unsigned *num_segments);
+
+pool_group_pt
+mem_pool_group_open(unsigned num_shards, size_t size, alloc_policy policy);
+
+alloc_status
+mem_pool_group_close(pool_group_pt group);
+
+void *
+mem_group_new_alloc(pool_group_pt group, size_t size);
+
+alloc_status
+mem_group_del_alloc(pool_group_pt group, void *alloc);
+
 #endif //C_MEM_POOL_H
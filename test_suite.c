@@ -4,10 +4,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <setjmp.h>
+#include <threads.h>
 #include "cmocka.h"
 
 #include "mem_pool.h"
@@ -2314,7 +2317,1943 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***        5. STRESS TESTING            ***/
+/***        5. POOL EXTENSIONS           ***/
+/*******************************************/
+
+static void test_pool_quick_lists(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Deferred coalescing:
+     *
+     * 1. Turn on quick lists with a threshold of 4.
+     * 2. Allocate 100, 200, 300.
+     * 3. Deallocate the 200. It is parked as a gap, not indexed.
+     * 4. Allocate 200. The parked block is reused as is.
+     * 5. Deallocate the 100 and the 200. The two gaps stay separate.
+     * 6. Consolidate. The two gaps merge.
+     * 7. Deallocate the 300 and consolidate. Pool is one gap.
+     */
+
+    status = mem_pool_set_quick_lists(pool, 4);
+    assert_int_equal(status, ALLOC_OK);
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp0[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {pool->total_size-600, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 2, 2);
+
+    void * alloc3 = mem_new_alloc(pool, 200);
+    assert_ptr_equal(alloc3, alloc1);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc3);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp1[4] =
+            {
+                    {100, 0},
+                    {200, 0},
+                    {300, 1},
+                    {pool->total_size-600, 0}
+            };
+    check_pool(pool, exp1);
+
+    status = mem_pool_consolidate(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp2[3] =
+            {
+                    {300, 0},
+                    {300, 1},
+                    {pool->total_size-600, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 1, 2);
+
+    status = mem_del_alloc(pool, alloc2);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_consolidate(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp3[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp3);
+}
+
+
+static void test_pool_top_chunk(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Top chunk (BEST_FIT):
+     *
+     * 1. Allocate 100, 500, 100 and all but 50 of the rest.
+     * 2. Deallocate the 500. There are two gaps, 500 and a top of 50.
+     * 3. Allocate 40. The top chunk is the tighter fit.
+     * 4. Allocate 400. Only the 500 gap fits.
+     * 5. Deallocate everything. Pool is one gap.
+     */
+
+    size_t big_size = pool->total_size - 750;
+
+    void * alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    void * alloc1 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc1);
+    void * alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    void * alloc3 = mem_new_alloc(pool, big_size);
+    assert_non_null(alloc3);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, pool->total_size - 50, 4, 1);
+
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, pool->total_size - 550, 3, 2);
+
+    void * alloc4 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc4);
+
+    pool_segment_t exp0[6] =
+            {
+                    {100, 1},
+                    {500, 0},
+                    {100, 1},
+                    {big_size, 1},
+                    {40, 1},
+                    {10, 0}
+            };
+    check_pool(pool, exp0);
+
+    void * alloc5 = mem_new_alloc(pool, 400);
+    assert_non_null(alloc5);
+
+    pool_segment_t exp1[7] =
+            {
+                    {100, 1},
+                    {400, 1},
+                    {100, 0},
+                    {100, 1},
+                    {big_size, 1},
+                    {40, 1},
+                    {10, 0}
+            };
+    check_pool(pool, exp1);
+
+    void * allocs[] = {alloc3, alloc0, alloc4, alloc5, alloc2};
+    for (unsigned u = 0; u < sizeof(allocs) / sizeof(allocs[0]); u ++) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_exact_fit(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Exact-fit lookup (BEST_FIT):
+     *
+     * 1. Allocate 64 blocks of 10, 20, 30, 40, 10, 20, ...
+     * 2. Deallocate every other block, leaving 31 gaps of 20 and 40
+     *    (the last one merges with the top chunk).
+     * 3. Allocate 20. It goes to the lowest-address gap of 20.
+     * 4. Allocate 40. It goes to the lowest-address gap of 40.
+     * 5. Allocate 30. No exact match, it goes to the next gap of 40.
+     */
+
+    const unsigned num_allocs = 64;
+    void * allocs[num_allocs];
+
+    for (unsigned u = 0; u < num_allocs; u ++) {
+        allocs[u] = mem_new_alloc(pool, (u % 4 + 1) * 10);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 1; u < num_allocs; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, num_allocs / 2);
+
+    void * alloc0 = mem_new_alloc(pool, 20);
+    assert_ptr_equal(alloc0, allocs[1]);
+
+    void * alloc1 = mem_new_alloc(pool, 40);
+    assert_ptr_equal(alloc1, allocs[3]);
+
+    void * alloc2 = mem_new_alloc(pool, 30);
+    assert_ptr_equal(alloc2, allocs[7]);
+
+    allocs[1] = alloc0;
+    allocs[3] = alloc1;
+    allocs[7] = alloc2;
+    for (unsigned u = 0; u < num_allocs; u ++) {
+        if (u % 2 == 0 || u == 1 || u == 3 || u == 7) {
+            status = mem_del_alloc(pool, allocs[u]);
+            assert_int_equal(status, ALLOC_OK);
+        }
+    }
+
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_good_fit(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Bounded search (GOOD_FIT):
+     *
+     * 1. Allocate 300, 100, 200, 100, 150, 100.
+     * 2. Deallocate the 300, 200, 150, leaving those gaps in address order.
+     * 3. GOOD_FIT looks at the next K gaps in address order, resuming
+     *    where the previous search stopped, and takes the tightest:
+     *    a. K = 2, allocate 140: looks at 300, 200 and takes the 200.
+     *    b. K = 2, allocate 140: looks at 150, 300 and takes the 150.
+     *    c. K = 1, allocate 140: looks at 200 and takes it.
+     *    d. K = 1, allocate 250: looks at 150, which is too small, and
+     *       falls back on the tightest gap overall, the 300.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, GOOD_FIT);
+    assert_non_null(pool);
+    assert_int_equal(pool->policy, GOOD_FIT);
+
+    const size_t sizes[6] = {300, 100, 200, 100, 150, 100};
+    void * allocs[6];
+    for (unsigned u = 0; u < 6; u ++) {
+        allocs[u] = mem_new_alloc(pool, sizes[u]);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 6; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    const unsigned limits[4] = {2, 2, 1, 1};
+    const size_t requests[4] = {140, 140, 140, 250};
+    const unsigned expected[4] = {2, 4, 2, 0};
+    for (unsigned u = 0; u < 4; u ++) {
+        INFO("Allocating %lu with a search limit of %u\n", (unsigned long) requests[u], limits[u]);
+        status = mem_pool_set_search_limit(pool, limits[u]);
+        assert_int_equal(status, ALLOC_OK);
+
+        void * alloc = mem_new_alloc(pool, requests[u]);
+        assert_ptr_equal(alloc, allocs[expected[u]]);
+
+        status = mem_del_alloc(pool, alloc);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    status = mem_pool_set_search_limit(pool, 0);
+    assert_int_equal(status, ALLOC_FAIL);
+
+    for (unsigned u = 1; u < 6; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    check_metadata(pool, GOOD_FIT, POOL_SIZE, 0, 0, 1);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static void test_pool_set_policy(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Changing the policy of an open pool:
+     *
+     * 1. Allocate 300, 100, 200, 100, 150, 100.
+     * 2. Deallocate the 300, 200, 150.
+     * 3. Switch to GOOD_FIT with a limit of 2. Allocating 140 takes the 200.
+     * 4. Switch to BEST_FIT. Allocating 140 takes the 150.
+     * 5. Switch back to FIRST_FIT. Allocating 140 takes the 300.
+     */
+
+    const size_t sizes[6] = {300, 100, 200, 100, 150, 100};
+    void * allocs[6];
+    for (unsigned u = 0; u < 6; u ++) {
+        allocs[u] = mem_new_alloc(pool, sizes[u]);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 6; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    const alloc_policy policies[3] = {GOOD_FIT, BEST_FIT, FIRST_FIT};
+    const unsigned expected[3] = {2, 4, 0};
+    status = mem_pool_set_search_limit(pool, 2);
+    assert_int_equal(status, ALLOC_OK);
+    for (unsigned u = 0; u < 3; u ++) {
+        status = mem_pool_set_policy(pool, policies[u]);
+        assert_int_equal(status, ALLOC_OK);
+        assert_int_equal(pool->policy, policies[u]);
+
+        void * alloc = mem_new_alloc(pool, 140);
+        assert_ptr_equal(alloc, allocs[expected[u]]);
+
+        status = mem_del_alloc(pool, alloc);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    status = mem_pool_set_policy(pool, (alloc_policy) 42);
+    assert_int_equal(status, ALLOC_FAIL);
+
+    for (unsigned u = 1; u < 6; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_auto_policy(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Auto policy:
+     *
+     * 1. Fill phase: allocate 200 x 100. The pool stays FIRST_FIT.
+     * 2. Deallocate every other one, leaving ~100 gaps of 100.
+     * 3. Churn phase: allocate 64 x 50. Every FIRST_FIT search has ~100
+     *    sufficient gaps to look at, so the pool switches to BEST_FIT.
+     * 4. Deallocate everything and allocate 64 x 10 off the top chunk.
+     *    The pool switches back to FIRST_FIT.
+     */
+
+    const unsigned num_fill = 200;
+    const unsigned num_churn = 64;
+    void * fill[num_fill];
+    void * churn[num_churn];
+
+    status = mem_pool_set_auto_policy(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 0; u < num_fill; u ++) {
+        fill[u] = mem_new_alloc(pool, 100);
+        assert_non_null(fill[u]);
+    }
+    assert_int_equal(pool->policy, FIRST_FIT);
+
+    for (unsigned u = 1; u < num_fill; u += 2) {
+        status = mem_del_alloc(pool, fill[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    for (unsigned u = 0; u < num_churn; u ++) {
+        churn[u] = mem_new_alloc(pool, 50);
+        assert_non_null(churn[u]);
+    }
+    assert_int_equal(pool->policy, BEST_FIT);
+
+    for (unsigned u = 0; u < num_churn; u ++) {
+        status = mem_del_alloc(pool, churn[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    for (unsigned u = 0; u < num_fill; u += 2) {
+        status = mem_del_alloc(pool, fill[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    for (unsigned u = 0; u < num_churn; u ++) {
+        churn[u] = mem_new_alloc(pool, 10);
+        assert_non_null(churn[u]);
+    }
+    assert_int_equal(pool->policy, FIRST_FIT);
+
+    for (unsigned u = 0; u < num_churn; u ++) {
+        status = mem_del_alloc(pool, churn[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    status = mem_pool_set_auto_policy(pool, 0);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_alloc_hint(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Lifetime hints:
+     *
+     * 1. Allocate 100 long-lived. It goes to the low end.
+     * 2. Allocate 200 and 50 short-lived. They go to the high end.
+     * 3. Allocate 300 long-lived. It goes right after the 100.
+     * 4. Deallocate the short-lived ones. The gap reaches the end again.
+     * 5. Deallocate the long-lived ones. Pool is one gap.
+     */
+
+    void * long0 = mem_new_alloc_hint(pool, 100, MEM_HINT_LONG);
+    assert_non_null(long0);
+    void * short0 = mem_new_alloc_hint(pool, 200, MEM_HINT_SHORT);
+    assert_non_null(short0);
+    void * short1 = mem_new_alloc_hint(pool, 50, MEM_HINT_SHORT);
+    assert_non_null(short1);
+    void * long1 = mem_new_alloc_hint(pool, 300, MEM_HINT_LONG);
+    assert_non_null(long1);
+
+    pool_segment_t exp0[5] =
+            {
+                    {100, 1},
+                    {300, 1},
+                    {pool->total_size-650, 0},
+                    {50, 1},
+                    {200, 1}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 650, 4, 1);
+
+    status = mem_del_alloc(pool, short0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, short1);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp1[3] =
+            {
+                    {100, 1},
+                    {300, 1},
+                    {pool->total_size-400, 0}
+            };
+    check_pool(pool, exp1);
+
+    assert_null(mem_new_alloc_hint(pool, 10, (alloc_hint) 42));
+
+    status = mem_del_alloc(pool, long0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, long1);
+    assert_int_equal(status, ALLOC_OK);
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_alloc_near(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Allocation near a neighbour:
+     *
+     * 1. Allocate 6 x 100 and deallocate the 2nd and the 5th.
+     * 2. Allocate 50 near the 4th. The 5th gap is right after it, so
+     *    the allocation goes to the low end of that gap.
+     * 3. Allocate 50 near the 3rd. The 2nd gap is right before it, so
+     *    the allocation goes to the high end of that gap.
+     */
+
+    void * allocs[6];
+    for (unsigned u = 0; u < 6; u ++) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    status = mem_del_alloc(pool, allocs[1]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[4]);
+    assert_int_equal(status, ALLOC_OK);
+
+    void * near0 = mem_new_alloc_near(pool, 50, allocs[3]);
+    assert_non_null(near0);
+    void * near1 = mem_new_alloc_near(pool, 50, allocs[2]);
+    assert_non_null(near1);
+
+    pool_segment_t exp0[9] =
+            {
+                    {100, 1},
+                    {50, 0},
+                    {50, 1},
+                    {100, 1},
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {pool->total_size-600, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 500, 6, 3);
+
+    status = mem_del_alloc(pool, near0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, near1);
+    assert_int_equal(status, ALLOC_OK);
+    for (unsigned u = 0; u < 6; u ++) {
+        if (u != 1 && u != 4) {
+            status = mem_del_alloc(pool, allocs[u]);
+            assert_int_equal(status, ALLOC_OK);
+        }
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_lifo_reuse(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Reuse of the most recently freed gap:
+     *
+     * 1. Allocate 5 x 100 and deallocate the 1st, then the 3rd.
+     * 2. With LIFO reuse, allocate 100. It goes to the 3rd gap,
+     *    not to the lowest one.
+     * 3. Deallocate it and the 4th. They merge into a gap of 200.
+     * 4. Allocate 100. It goes to the 200 gap (the most recent),
+     *    not to the tight 100 gap.
+     * 5. Without LIFO reuse, allocate 100. It goes to the 1st gap.
+     */
+
+    void * allocs[5];
+    for (unsigned u = 0; u < 5; u ++) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    status = mem_del_alloc(pool, allocs[0]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[2]);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_pool_set_lifo_reuse(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    void * lifo0 = mem_new_alloc(pool, 100);
+    assert_non_null(lifo0);
+
+    pool_segment_t exp0[6] =
+            {
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size-500, 0}
+            };
+    check_pool(pool, exp0);
+
+    status = mem_del_alloc(pool, lifo0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[3]);
+    assert_int_equal(status, ALLOC_OK);
+
+    void * lifo1 = mem_new_alloc(pool, 100);
+    assert_non_null(lifo1);
+
+    pool_segment_t exp1[6] =
+            {
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size-500, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 3, 3);
+
+    status = mem_pool_set_lifo_reuse(pool, 0);
+    assert_int_equal(status, ALLOC_OK);
+
+    void * ff0 = mem_new_alloc(pool, 100);
+    assert_non_null(ff0);
+
+    pool_segment_t exp2[6] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size-500, 0}
+            };
+    check_pool(pool, exp2);
+
+    status = mem_del_alloc(pool, ff0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, lifo1);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[1]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[4]);
+    assert_int_equal(status, ALLOC_OK);
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_cache_align(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Cache line placement:
+     *
+     * 1. With alignment, allocate 10 and 100. They are rounded up to
+     *    64 and 128, and start on cache lines.
+     * 2. With coloring too, allocate 3 x 64. They are offset by 0, 1
+     *    and 2 cache lines, the slack stays a gap.
+     * 3. Deallocate all. Pool is one gap.
+     */
+
+    assert_int_equal((unsigned long) pool->mem % 64, 0);
+
+    status = mem_pool_set_cache_align(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    alloc_pt allocs[5];
+    allocs[0] = mem_new_alloc(pool, 10);
+    assert_non_null(allocs[0]);
+    allocs[1] = mem_new_alloc(pool, 100);
+    assert_non_null(allocs[1]);
+    assert_int_equal(allocs[0]->size, 64);
+    assert_int_equal(allocs[1]->size, 128);
+    assert_int_equal((allocs[1]->mem - pool->mem) % 64, 0);
+
+    status = mem_pool_set_cache_coloring(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 2; u < 5; u ++) {
+        allocs[u] = mem_new_alloc(pool, 64);
+        assert_non_null(allocs[u]);
+        assert_int_equal((allocs[u]->mem - pool->mem) % 64, 0);
+    }
+
+    pool_segment_t exp0[8] =
+            {
+                    {64, 1},
+                    {128, 1},
+                    {64, 1},
+                    {64, 0},
+                    {64, 1},
+                    {128, 0},
+                    {64, 1},
+                    {pool->total_size-576, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 384, 5, 3);
+
+    for (unsigned u = 0; u < 5; u ++) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_size_classes(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Size classes and minimum split:
+     *
+     * 1. With a 16-byte grid, allocate 10 and 17. They are rounded up
+     *    to 16 and 32. A size that would round past SIZE_MAX fails.
+     * 2. With geometric classes, allocate 513 and 1000. They are
+     *    rounded up to 576 and 1024.
+     * 3. Back to exact sizes, with a minimum split of 32, allocate 100
+     *    and 100 and deallocate the 1st. Allocate 80 in its place. The
+     *    remainder of 20 stays with the allocation.
+     */
+
+    alloc_pt allocs[6];
+
+    status = mem_pool_set_size_classes(pool, MEM_SIZE_STEP, 16);
+    assert_int_equal(status, ALLOC_OK);
+    allocs[0] = mem_new_alloc(pool, 10);
+    assert_non_null(allocs[0]);
+    assert_int_equal(allocs[0]->size, 16);
+    allocs[1] = mem_new_alloc(pool, 17);
+    assert_non_null(allocs[1]);
+    assert_int_equal(allocs[1]->size, 32);
+    assert_null(mem_new_alloc(pool, SIZE_MAX - 2));
+
+    status = mem_pool_set_size_classes(pool, MEM_SIZE_GEOMETRIC, 16);
+    assert_int_equal(status, ALLOC_OK);
+    allocs[2] = mem_new_alloc(pool, 513);
+    assert_non_null(allocs[2]);
+    assert_int_equal(allocs[2]->size, 576);
+    allocs[3] = mem_new_alloc(pool, 1000);
+    assert_non_null(allocs[3]);
+    assert_int_equal(allocs[3]->size, 1024);
+
+    status = mem_pool_set_size_classes(pool, MEM_SIZE_STEP, 0);
+    assert_int_equal(status, ALLOC_FAIL);
+    status = mem_pool_set_size_classes(pool, MEM_SIZE_EXACT, 0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_set_min_split(pool, 32);
+    assert_int_equal(status, ALLOC_OK);
+
+    allocs[4] = mem_new_alloc(pool, 100);
+    assert_non_null(allocs[4]);
+    allocs[5] = mem_new_alloc(pool, 100);
+    assert_non_null(allocs[5]);
+    status = mem_del_alloc(pool, allocs[4]);
+    assert_int_equal(status, ALLOC_OK);
+    allocs[4] = mem_new_alloc(pool, 80);
+    assert_non_null(allocs[4]);
+    assert_int_equal(allocs[4]->size, 100);
+
+    pool_segment_t exp0[7] =
+            {
+                    {16, 1},
+                    {32, 1},
+                    {576, 1},
+                    {1024, 1},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size-1848, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1848, 6, 1);
+
+    for (unsigned u = 0; u < 6; u ++) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static int tcache_thread(void *arg) {
+    pool_pt pool = arg;
+    void * allocs[40];
+
+    for (unsigned u = 0; u < 40; u ++) {
+        allocs[u] = mem_new_alloc(pool, 24);
+        if (allocs[u] == NULL) return 1;
+    }
+    for (unsigned u = 0; u < 40; u ++) {
+        if (mem_del_alloc(pool, allocs[u]) != ALLOC_OK) return 1;
+    }
+
+    // the thread cache is flushed at exit
+    return 0;
+}
+
+static void test_pool_tcache(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Thread caches:
+     *
+     * 1. With thread caches, allocate 10. The cache is refilled with a
+     *    batch of 8 blocks of 16, all allocations as far as the pool
+     *    is concerned.
+     * 2. Deallocate it. It stays in the cache, and comes back on the
+     *    next allocation of the same size class.
+     * 3. Another thread allocates and deallocates 40 x 24 and exits.
+     *    Past the high-water mark, 17 blocks of 32 go to the depot. The
+     *    rest of its cache is given back to the pool.
+     * 4. Turn the thread caches off. The depot is given back too. Pool
+     *    is one gap.
+     */
+
+    status = mem_pool_set_tcache(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 16);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 128, 8, 1);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 128, 8, 1);
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 16);
+    assert_ptr_equal(alloc1, alloc0);
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+
+    thrd_t thread;
+    int result = -1;
+    assert_int_equal(thrd_create(&thread, tcache_thread, pool), thrd_success);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 672, 25, 2);
+
+    status = mem_pool_set_tcache(pool, 0);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static int tcache_depot_thread(void *arg) {
+    pool_pt pool = arg;
+    void * allocs[20];
+
+    for (unsigned u = 0; u < 20; u ++) {
+        allocs[u] = mem_new_alloc(pool, 16);
+        if (allocs[u] == NULL) return 1;
+    }
+    for (unsigned u = 0; u < 20; u ++) {
+        if (mem_del_alloc(pool, allocs[u]) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_tcache_depot(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+    void * allocs[40];
+
+    /*
+     * Thread cache depot and stealing:
+     *
+     * 1. With thread caches, allocate and deallocate 40 x 16. Past the
+     *    high-water mark, 17 go to the depot, 23 stay in the cache.
+     * 2. Another thread allocates 20 x 16. It takes the 17 in the depot,
+     *    then steals the older 12 of this thread's cache, and nothing
+     *    from the pool. It deallocates them and exits, giving back 29.
+     * 3. Turn the thread caches off. Pool is one gap.
+     */
+
+    status = mem_pool_set_tcache(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 0; u < 40; u ++) {
+        allocs[u] = mem_new_alloc(pool, 16);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 40; u ++) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 640, 40, 1);
+
+    thrd_t thread;
+    int result = -1;
+    assert_int_equal(thrd_create(&thread, tcache_depot_thread, pool), thrd_success);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 176, 11, 3);
+
+    status = mem_pool_set_tcache(pool, 0);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static int shared_pool_thread(void *arg) {
+    pool_pt pool = arg;
+    void * allocs[16] = {NULL};
+
+    for (unsigned u = 0; u < 2000; u ++) {
+        unsigned ix = (u * 7) % 16;
+
+        if (allocs[ix] != NULL && mem_del_alloc(pool, allocs[ix]) != ALLOC_OK) return 1;
+        allocs[ix] = mem_new_alloc(pool, (u * 37) % 700 + 1);
+        if (allocs[ix] == NULL) return 1;
+    }
+    for (unsigned u = 0; u < 16; u ++) {
+        if (mem_del_alloc(pool, allocs[u]) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_shared(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Shared pools:
+     *
+     * For a mutex, a spinlock, and a mutex with thread caches:
+     * 1. Open a shared pool.
+     * 2. 8 threads allocate and deallocate in it at the same time.
+     * 3. Once they are done, pool is one gap.
+     */
+
+    const unsigned flags[3] = {MEM_POOL_SHARED, MEM_POOL_SPIN, MEM_POOL_SHARED};
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned f = 0; f < 3; f ++) {
+        pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, flags[f]);
+        assert_non_null(pool);
+        if (f == 2) {
+            status = mem_pool_set_tcache(pool, 1);
+            assert_int_equal(status, ALLOC_OK);
+        }
+
+        thrd_t threads[8];
+        for (unsigned t = 0; t < 8; t ++) {
+            assert_int_equal(thrd_create(&threads[t], shared_pool_thread, pool), thrd_success);
+        }
+        for (unsigned t = 0; t < 8; t ++) {
+            int result = -1;
+            assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+            assert_int_equal(result, 0);
+        }
+
+        check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+        status = mem_pool_close(pool);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int group_thread(void *arg) {
+    void ** args = arg;
+    pool_group_pt group = args[0];
+    void ** allocs = args + 1;
+
+    for (unsigned u = 0; u < 100; u ++) {
+        allocs[u] = mem_group_new_alloc(group, u + 1);
+        if (allocs[u] == NULL) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_group(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Sharded pool groups:
+     *
+     * 1. Open a group of 4 shards of 10000 bytes.
+     * 2. Allocate 9000 five times. Each shard takes one, the fifth fails.
+     * 3. 4 threads allocate 100 blocks each, the main thread
+     *    deallocates them. Each goes back to its own shard.
+     * 4. Deallocating a block from another pool fails.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_group_pt group = mem_pool_group_open(4, 10000, FIRST_FIT);
+    assert_non_null(group);
+    assert_int_equal(group->num_shards, 4);
+
+    void * big[4];
+    for (unsigned u = 0; u < 4; u ++) {
+        big[u] = mem_group_new_alloc(group, 9000);
+        assert_non_null(big[u]);
+    }
+    assert_null(mem_group_new_alloc(group, 9000));
+
+    status = mem_pool_group_close(group);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    for (unsigned u = 0; u < 4; u ++) {
+        status = mem_group_del_alloc(group, big[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    void * args[4][101];
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        args[t][0] = group;
+        assert_int_equal(thrd_create(&threads[t], group_thread, args[t]), thrd_success);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        for (unsigned u = 1; u <= 100; u ++) {
+            status = mem_group_del_alloc(group, args[t][u]);
+            assert_int_equal(status, ALLOC_OK);
+        }
+    }
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    void * other = mem_new_alloc(pool, 100);
+    assert_non_null(other);
+    status = mem_group_del_alloc(group, other);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_del_alloc(pool, other);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_pool_group_close(group);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int remote_free_thread(void *arg) {
+    void ** args = arg;
+    pool_pt pool = args[0];
+    void ** allocs = args + 1;
+
+    // not the owner: cannot allocate, frees are handed back
+    if (mem_new_alloc(pool, 100) != NULL) return 1;
+    for (unsigned u = 0; u < 50; u ++) {
+        if (mem_del_alloc(pool, allocs[u]) != ALLOC_OK) return 1;
+    }
+    // a pending block is not freed twice
+    if (mem_del_alloc(pool, allocs[0]) != ALLOC_NOT_FREED) return 1;
+    if (mem_pool_close(pool) != ALLOC_NOT_FREED) return 1;
+
+    return 0;
+}
+
+static int remote_double_free_thread(void *arg) {
+    void ** args = arg;
+    pool_pt pool = args[0];
+    int freed = 0;
+
+    // races another thread freeing the same blocks
+    for (unsigned u = 51; u <= 100; u ++) {
+        if (mem_del_alloc(pool, args[u]) == ALLOC_OK) freed ++;
+    }
+
+    return freed;
+}
+
+static void test_pool_remote_free(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Remote frees on an owned pool:
+     *
+     * 1. An owned pool can't also be shared.
+     * 2. The owner allocates 100 blocks of 100.
+     * 3. Another thread deallocates the first 50. They stay
+     *    allocations until the owner's next call.
+     * 4. The owner allocates 100, taking in the remote frees.
+     * 5. Two threads deallocate the other 50 at the same time. Each
+     *    block is handed back once.
+     * 6. The owner allocates 100 again, taking them in, and deallocates.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    assert_null(mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_OWNED | MEM_POOL_SHARED));
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_OWNED);
+    assert_non_null(pool);
+
+    void * args[101];
+    args[0] = pool;
+    for (unsigned u = 1; u <= 100; u ++) {
+        args[u] = mem_new_alloc(pool, 100);
+        assert_non_null(args[u]);
+    }
+
+    thrd_t thread;
+    int result = -1;
+    assert_int_equal(thrd_create(&thread, remote_free_thread, args), thrd_success);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100 * 100, 100, 1);
+
+    void * alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 51 * 100, 51, 2);
+
+    thrd_t threads[2];
+    int freed = 0;
+    for (unsigned t = 0; t < 2; t ++) {
+        assert_int_equal(thrd_create(&threads[t], remote_double_free_thread, args), thrd_success);
+    }
+    for (unsigned t = 0; t < 2; t ++) {
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        freed += result;
+    }
+    assert_int_equal(freed, 50);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 51 * 100, 51, 2);
+
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int pool_store_thread(void *arg) {
+    (void) arg;
+
+    for (unsigned u = 0; u < 200; u ++) {
+        pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+        if (pool == NULL) return 1;
+        if (mem_pool_find(pool->mem + u) != pool) return 1;
+        if (mem_pool_close(pool) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_store(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Concurrent pool store:
+     *
+     * 1. Open 3 pools and find each by an address in its memory.
+     * 2. Close the middle one, it can't be found any more.
+     * 3. 4 threads open, find and close 200 pools each while
+     *    the other 2 pools can still be found.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pools[3];
+    for (unsigned u = 0; u < 3; u ++) {
+        pools[u] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[u]);
+    }
+    for (unsigned u = 0; u < 3; u ++) {
+        assert_ptr_equal(mem_pool_find(pools[u]->mem), pools[u]);
+        assert_ptr_equal(mem_pool_find(pools[u]->mem + POOL_SIZE - 1), pools[u]);
+    }
+    assert_null(mem_pool_find(&status));
+
+    char * mem = pools[1]->mem;
+    status = mem_pool_close(pools[1]);
+    assert_int_equal(status, ALLOC_OK);
+    assert_null(mem_pool_find(mem));
+
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        assert_int_equal(thrd_create(&threads[t], pool_store_thread, NULL), thrd_success);
+    }
+    for (unsigned u = 0; u < 100; u ++) {
+        assert_ptr_equal(mem_pool_find(pools[0]->mem), pools[0]);
+        assert_ptr_equal(mem_pool_find(pools[2]->mem), pools[2]);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_pool_close(pools[0]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pools[2]);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int arena_thread(void *arg) {
+    void ** args = arg;
+    pool_pt pool = args[0];
+    void ** allocs = args + 1;
+
+    for (unsigned u = 0; u < 100; u ++) {
+        allocs[u] = mem_arena_alloc(pool, u % 16 + 1);
+        if (allocs[u] == NULL) return 1;
+        memset(allocs[u], 0xa5, u % 16 + 1);
+    }
+
+    return 0;
+}
+
+static int compare_ptrs(const void *a, const void *b) {
+    const char * pa = *(char * const *) a;
+    const char * pb = *(char * const *) b;
+
+    return (pa > pb) - (pa < pb);
+}
+
+static void test_pool_arena(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Bump allocation in a shared arena:
+     *
+     * 1. Open an arena of 10000. Ordinary allocations fail.
+     * 2. 4 threads allocate 100 blocks each. Sizes round up to 16,
+     *    so the blocks are distinct and 16 apart.
+     * 3. The remaining 3600 can be allocated exactly, then nothing.
+     * 4. A reset makes the whole arena available again.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open_ex(10000, FIRST_FIT, MEM_POOL_ARENA);
+    assert_non_null(pool);
+    assert_null(mem_new_alloc(pool, 100));
+
+    void * args[4][101];
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        args[t][0] = pool;
+        assert_int_equal(thrd_create(&threads[t], arena_thread, args[t]), thrd_success);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+
+    void * allocs[400];
+    for (unsigned t = 0; t < 4; t ++) {
+        memcpy(allocs + t * 100, args[t] + 1, 100 * sizeof(void *));
+    }
+    qsort(allocs, 400, sizeof(void *), compare_ptrs);
+    for (unsigned u = 0; u < 400; u ++) {
+        assert_ptr_equal(allocs[u], pool->mem + u * 16);
+    }
+
+    assert_null(mem_arena_alloc(pool, 3601));
+    assert_ptr_equal(mem_arena_alloc(pool, 3600), pool->mem + 6400);
+    assert_null(mem_arena_alloc(pool, 1));
+
+    status = mem_arena_reset(pool);
+    assert_int_equal(status, ALLOC_OK);
+    assert_ptr_equal(mem_arena_alloc(pool, 10000), pool->mem);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int slab_thread(void *arg) {
+    pool_pt pool = arg;
+    char * objects[4];
+
+    for (unsigned u = 0; u < 10000; u ++) {
+        for (unsigned o = 0; o < 4; o ++) {
+            objects[o] = mem_slab_alloc(pool);
+            if (objects[o] == NULL) return 1;
+            memset(objects[o], (int) o, 24);
+        }
+        for (unsigned o = 0; o < 4; o ++) {
+            if (objects[o][23] != (char) o) return 1;
+            if (mem_slab_free(pool, objects[o]) != ALLOC_OK) return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void test_pool_slab(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Lock-free fixed-size slab:
+     *
+     * 1. Open a slab of 1000 with 24-byte objects (32 apart), so 31 fit.
+     * 2. Allocate all 31 in address order, then nothing.
+     * 3. Freeing a pointer into an object, or twice, fails.
+     * 4. 4 threads allocate and free 4 objects at a time.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    assert_null(mem_pool_open_ex(1000, FIRST_FIT, MEM_POOL_SLAB));
+    pool_pt pool = mem_pool_open_slab(1000, 24);
+    assert_non_null(pool);
+    assert_null(mem_new_alloc(pool, 24));
+
+    char * objects[31];
+    for (unsigned u = 0; u < 31; u ++) {
+        objects[u] = mem_slab_alloc(pool);
+        assert_ptr_equal(objects[u], pool->mem + u * 32);
+    }
+    assert_null(mem_slab_alloc(pool));
+
+    status = mem_slab_free(pool, objects[3] + 8);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_slab_free(pool, objects[3]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_slab_free(pool, objects[3]);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    assert_ptr_equal(mem_slab_alloc(pool), objects[3]);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    for (unsigned u = 0; u < 31; u ++) {
+        status = mem_slab_free(pool, objects[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        assert_int_equal(thrd_create(&threads[t], slab_thread, pool), thrd_success);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int lanes_thread(void *arg) {
+    pool_pt pool = arg;
+    void * allocs[50];
+
+    for (unsigned u = 0; u < 50; u ++) {
+        allocs[u] = mem_new_alloc(pool, 16);
+        if (allocs[u] == NULL) return 1;
+    }
+    for (unsigned u = 0; u < 50; u ++) {
+        if (mem_del_alloc(pool, allocs[u]) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_lanes(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status;
+
+    /*
+     * Address-range lanes in one pool:
+     *
+     * 1. Open a pool of 4000 with 4 lanes: 3 of 960, the last one 1120.
+     * 2. Allocate 1500. No lane has the room, so the boundary between
+     *    the first two lanes moves up by 896, and the first lane takes it.
+     *    The pool's counters are up to date without inspecting it.
+     * 3. 4 threads allocate and deallocate 50 blocks each.
+     * 4. With thread caches on, allocate 32, deallocate, and allocate 32
+     *    again. The same block comes back from the cache. Turn them off.
+     * 5. Deallocate. The boundary moves back, the lanes are as opened.
+     *    2100 doesn't fit in two lanes, so it fails on the empty pool.
+     *    The pool can be closed.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    assert_null(mem_pool_open_ex(4000, FIRST_FIT, MEM_POOL_LANES));
+    pool_pt pool = mem_pool_open_lanes(4000, FIRST_FIT, 4);
+    assert_non_null(pool);
+    check_metadata(pool, FIRST_FIT, 4000, 0, 0, 4);
+
+    void * alloc = mem_new_alloc(pool, 1500);
+    assert_non_null(alloc);
+    assert_int_equal(pool->alloc_size, 1500);
+    assert_int_equal(pool->num_allocs, 1);
+    assert_int_equal(pool->num_gaps, 4);
+    pool_segment_t exp[5] =
+            {
+                    {1500, 1},
+                    {356, 0},
+                    {64, 0},
+                    {960, 0},
+                    {1120, 0}
+            };
+    check_pool(pool, exp);
+    check_metadata(pool, FIRST_FIT, 4000, 1500, 1, 4);
+
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        assert_int_equal(thrd_create(&threads[t], lanes_thread, pool), thrd_success);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+    assert_int_equal(pool->alloc_size, 1500);
+    assert_int_equal(pool->num_allocs, 1);
+    check_metadata(pool, FIRST_FIT, 4000, 1500, 1, 4);
+
+    status = mem_pool_set_tcache(pool, 1);
+    assert_int_equal(status, ALLOC_OK);
+    void * cached = mem_new_alloc(pool, 32);
+    assert_non_null(cached);
+    status = mem_del_alloc(pool, cached);
+    assert_int_equal(status, ALLOC_OK);
+    assert_ptr_equal(mem_new_alloc(pool, 32), cached);
+    status = mem_del_alloc(pool, cached);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_set_tcache(pool, 0);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, 4000, 1500, 1, 4);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    pool_segment_t exp_opened[4] =
+            {
+                    {960, 0},
+                    {960, 0},
+                    {960, 0},
+                    {1120, 0}
+            };
+    check_pool(pool, exp_opened);
+    check_metadata(pool, FIRST_FIT, 4000, 0, 0, 4);
+    assert_null(mem_new_alloc(pool, 2100));
+    check_pool(pool, exp_opened);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int epoch_thread(void *arg) {
+    (void) arg;
+
+    // never leaves, the record is given up at thread exit
+    return mem_epoch_enter() == ALLOC_OK ? 0 : 1;
+}
+
+static void test_pool_epoch(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Deferred frees:
+     *
+     * 1. Allocate 100 and 200. Enter an epoch (twice, nested) and free
+     *    100 deferred. It can't be freed again. Allocate 50. This thread
+     *    is still inside, so 100 stays an allocation.
+     * 2. Leave the epoch (twice). Free 50 deferred. Nobody is inside, so
+     *    100 and 50 go back to the pool.
+     * 3. Another thread enters an epoch and exits. Free 200 deferred. It
+     *    goes back right away. Pool is one gap.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+
+    assert_int_equal(mem_epoch_enter(), ALLOC_OK);
+    assert_int_equal(mem_epoch_enter(), ALLOC_OK);
+    status = mem_del_alloc_deferred(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc_deferred(pool, alloc0);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc2);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 350, 3, 1);
+
+    assert_int_equal(mem_epoch_exit(), ALLOC_OK);
+    assert_int_equal(mem_epoch_exit(), ALLOC_OK);
+    assert_int_equal(mem_epoch_exit(), ALLOC_FAIL);
+    status = mem_del_alloc_deferred(pool, alloc2);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 200, 1, 2);
+
+    thrd_t thread;
+    int result = -1;
+    assert_int_equal(thrd_create(&thread, epoch_thread, NULL), thrd_success);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+
+    status = mem_del_alloc_deferred(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_maintenance(void **state) {
+    (void) state;
+    alloc_status status;
+    void * allocs[100];
+
+    /*
+     * Background maintenance:
+     *
+     * 1. Initialize the store with a maintenance thread. A shared pool
+     *    with quick lists allocates and deallocates 100 x 64, leaving
+     *    blocks parked on the quick lists.
+     * 2. A maintenance pass merges them. Pool is one gap.
+     * 3. Two more passes on the idle pool purge its gaps. The memory
+     *    is still there to allocate and write.
+     */
+
+    status = mem_init_ex(MEM_INIT_MAINTENANCE);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_init_ex(MEM_INIT_MAINTENANCE);
+    assert_int_equal(status, ALLOC_CALLED_AGAIN);
+
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_SHARED);
+    assert_non_null(pool);
+    status = mem_pool_set_quick_lists(pool, 4);
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 0; u < 100; u ++) {
+        allocs[u] = mem_new_alloc(pool, 64);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 100; u ++) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+
+    status = mem_maintain();
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    status = mem_maintain();
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_maintain();
+    assert_int_equal(status, ALLOC_OK);
+
+    alloc_pt alloc = mem_new_alloc(pool, POOL_SIZE);
+    assert_non_null(alloc);
+    memset(alloc->mem, 0xff, alloc->size);
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_maintain();
+    assert_int_equal(status, ALLOC_FAIL);
+}
+
+
+static int alloc_wait_thread(void *arg) {
+    alloc_pt *allocs = arg;
+    struct timespec delay = {0, 20000000};
+
+    thrd_sleep(&delay, NULL);
+    if (mem_del_alloc(mem_pool_find(allocs[0]->mem), allocs[0]) != ALLOC_OK) return 1;
+
+    return 0;
+}
+
+static void test_pool_alloc_wait(void **state) {
+    (void) state;
+    alloc_status status;
+    alloc_pt allocs[1];
+
+    /*
+     * Blocking allocation:
+     *
+     * 1. A shared pool of 1000 is full. A wait of 0 ms fails right away,
+     *    a wait of 20 ms fails when it times out.
+     * 2. Another thread deallocates the block 20 ms later. A wait of up
+     *    to 5 s gets it.
+     * 3. With quick lists on, the pool is full of blocks of 100. Another
+     *    thread deallocates one (onto a quick list) 20 ms later. A wait
+     *    of up to 5 s gets it, well before the timeout.
+     * 4. A pool of 2 lanes of 1024 is full. Another thread deallocates a
+     *    block 20 ms later. A wait of up to 5 s gets it, well before the
+     *    timeout.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool_pt pool = mem_pool_open_ex(1000, FIRST_FIT, MEM_POOL_SHARED);
+    assert_non_null(pool);
+
+    allocs[0] = mem_new_alloc(pool, 1000);
+    assert_non_null(allocs[0]);
+    assert_null(mem_new_alloc_wait(pool, 100, 0));
+    assert_null(mem_new_alloc_wait(pool, 100, 20));
+
+    thrd_t thread;
+    int result = -1;
+    assert_int_equal(thrd_create(&thread, alloc_wait_thread, allocs), thrd_success);
+    alloc_pt alloc = mem_new_alloc_wait(pool, 100, 5000);
+    assert_non_null(alloc);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+    check_metadata(pool, FIRST_FIT, 1000, 100, 1, 1);
+
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+
+    alloc_pt blocks[10];
+    struct timespec start, end;
+
+    status = mem_pool_set_quick_lists(pool, 16);
+    assert_int_equal(status, ALLOC_OK);
+    for (unsigned u = 0; u < 10; u ++) {
+        blocks[u] = mem_new_alloc(pool, 100);
+        assert_non_null(blocks[u]);
+    }
+    allocs[0] = blocks[5];
+    timespec_get(&start, TIME_UTC);
+    assert_int_equal(thrd_create(&thread, alloc_wait_thread, allocs), thrd_success);
+    blocks[5] = mem_new_alloc_wait(pool, 100, 5000);
+    assert_non_null(blocks[5]);
+    timespec_get(&end, TIME_UTC);
+    assert_true(end.tv_sec - start.tv_sec < 4);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+
+    for (unsigned u = 0; u < 10; u ++) {
+        status = mem_del_alloc(pool, blocks[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool = mem_pool_open_lanes(2048, FIRST_FIT, 2);
+    assert_non_null(pool);
+    blocks[0] = mem_new_alloc(pool, 1024);
+    assert_non_null(blocks[0]);
+    blocks[1] = mem_new_alloc(pool, 1024);
+    assert_non_null(blocks[1]);
+    assert_null(mem_new_alloc_wait(pool, 1024, 20));
+
+    allocs[0] = blocks[0];
+    timespec_get(&start, TIME_UTC);
+    assert_int_equal(thrd_create(&thread, alloc_wait_thread, allocs), thrd_success);
+    blocks[0] = mem_new_alloc_wait(pool, 1024, 5000);
+    assert_non_null(blocks[0]);
+    timespec_get(&end, TIME_UTC);
+    assert_true(end.tv_sec - start.tv_sec < 4);
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+
+    for (unsigned u = 0; u < 2; u ++) {
+        status = mem_del_alloc(pool, blocks[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static int lock_stats_thread(void *arg) {
+    pool_pt pool = arg;
+
+    for (unsigned u = 0; u < 1000; u ++) {
+        void * alloc = mem_new_alloc(pool, 100);
+        if (alloc == NULL) return 1;
+        if (mem_del_alloc(pool, alloc) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void test_pool_lock_stats(void **state) {
+    (void) state;
+    alloc_status status;
+    pool_lock_stats_t stats;
+
+    /*
+     * Lock contention stats:
+     *
+     * 1. A pool without a lock has no stats. A shared pool counts its
+     *    acquisitions, but doesn't time the hold without being asked to.
+     * 2. A shared pool that times it allocates and deallocates 10 x 100.
+     *    That's 20 acquisitions of its lock, 21 with the query, none
+     *    contended.
+     * 3. 4 threads allocate and deallocate 1000 x 100 each. That's 8000
+     *    more acquisitions, and contended ones waited.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    status = mem_pool_lock_stats(pool, &stats);
+    assert_int_equal(status, ALLOC_FAIL);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_SHARED);
+    assert_non_null(pool);
+    void * alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    status = mem_del_alloc(pool, alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_lock_stats(pool, &stats);
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(stats.acquisitions, 3);
+    assert_int_equal(stats.max_hold_ns, 0);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_SHARED | MEM_POOL_LOCK_STATS);
+    assert_non_null(pool);
+    for (unsigned u = 0; u < 10; u ++) {
+        void * alloc = mem_new_alloc(pool, 100);
+        assert_non_null(alloc);
+        status = mem_del_alloc(pool, alloc);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    status = mem_pool_lock_stats(pool, &stats);
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(stats.acquisitions, 21);
+    assert_int_equal(stats.contended, 0);
+    assert_int_equal(stats.wait_ns, 0);
+    assert_true(stats.max_hold_ns > 0);
+
+    thrd_t threads[4];
+    for (unsigned t = 0; t < 4; t ++) {
+        assert_int_equal(thrd_create(&threads[t], lock_stats_thread, pool), thrd_success);
+    }
+    for (unsigned t = 0; t < 4; t ++) {
+        int result = -1;
+        assert_int_equal(thrd_join(threads[t], &result), thrd_success);
+        assert_int_equal(result, 0);
+    }
+    status = mem_pool_lock_stats(pool, &stats);
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(stats.acquisitions, 8022);
+    assert_true(stats.contended <= 8000);
+    assert_true(stats.contended == 0 || stats.wait_ns > 0);
+
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+static void test_pool_close_many(void **state) {
+    (void) state;
+    alloc_status status;
+    pool_pt pools[20];
+
+    /*
+     * Parallel teardown:
+     *
+     * 1. Open 20 pools: shared, plain, owned, and with thread caches
+     *    holding this thread's blocks. One of them has an allocation.
+     * 2. Close them all at once. All but the allocated one close.
+     * 3. Deallocate, close it. Open 10 more pools and free the store
+     *    with 4 threads, closing them.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 0; u < 20; u ++) {
+        pools[u] = mem_pool_open_ex(POOL_SIZE, FIRST_FIT,
+                                    u % 3 == 0 ? MEM_POOL_SHARED : u % 3 == 1 ? 0 : MEM_POOL_OWNED);
+        assert_non_null(pools[u]);
+    }
+    status = mem_pool_set_tcache(pools[3], 1);
+    assert_int_equal(status, ALLOC_OK);
+    void * cached = mem_new_alloc(pools[3], 16);
+    assert_non_null(cached);
+    status = mem_del_alloc(pools[3], cached);
+    assert_int_equal(status, ALLOC_OK);
+    alloc_pt alloc = mem_new_alloc(pools[7], 100);
+    assert_non_null(alloc);
+
+    status = mem_pool_close_many(pools, 20);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    assert_ptr_equal(mem_pool_find(alloc->mem), pools[7]);
+    check_metadata(pools[7], FIRST_FIT, POOL_SIZE, 100, 1, 1);
+
+    status = mem_del_alloc(pools[7], alloc);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pools[7]);
+    assert_int_equal(status, ALLOC_OK);
+
+    for (unsigned u = 0; u < 10; u ++) {
+        pools[u] = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, u % 2 ? MEM_POOL_SHARED : 0);
+        assert_non_null(pools[u]);
+    }
+    status = mem_free_parallel(4);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_free_parallel(4);
+    assert_int_equal(status, ALLOC_CALLED_AGAIN);
+}
+
+
+static int snapshot_thread(void *arg) {
+    pool_pt pool = arg;
+
+    for (unsigned u = 0; u < 2000; u ++) {
+        alloc_pt alloc = mem_new_alloc(pool, u % 50 + 1);
+        if (! alloc) return 1;
+        if (mem_del_alloc(pool, alloc) != ALLOC_OK) return 1;
+    }
+
+    return 0;
+}
+
+static void check_snapshot(pool_segment_pt segs, unsigned num_segs) {
+    size_t total = 0;
+
+    for (unsigned u = 0; u < num_segs; u ++) {
+        total += segs[u].size;
+        if (u > 0) assert_true(segs[u - 1].allocated || segs[u].allocated);
+    }
+    assert_int_equal(total, POOL_SIZE);
+}
+
+static void test_pool_snapshot(void **state) {
+    (void) state;
+    alloc_status status;
+    pool_segment_t segs[10];
+    unsigned num_segs = 0;
+
+    /*
+     * Snapshot inspection:
+     *
+     * 1. A shared pool with 100, 200 (deallocated) and 300. A buffer of
+     *    2 fails and tells the 4 segments needed, a buffer of 10 gets them.
+     * 2. Another thread allocates and deallocates while this one takes
+     *    snapshots. Each one covers the pool, with no gaps side by side.
+     * 3. A plain pool is read the same way.
+     */
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+    pool_pt pool = mem_pool_open_ex(POOL_SIZE, FIRST_FIT, MEM_POOL_SHARED);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_inspect_pool_snapshot(pool, segs, 2, &num_segs);
+    assert_int_equal(status, ALLOC_FAIL);
+    assert_int_equal(num_segs, 4);
+
+    pool_segment_t exp[4] = {
+            {100, 1},
+            {200, 0},
+            {300, 1},
+            {POOL_SIZE - 600, 0}
+    };
+    status = mem_inspect_pool_snapshot(pool, segs, 10, &num_segs);
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(num_segs, 4);
+    assert_memory_equal(segs, exp, sizeof(exp));
+
+    thrd_t thread;
+    int result = -1;
+
+    assert_int_equal(thrd_create(&thread, snapshot_thread, pool), thrd_success);
+    for (unsigned u = 0; u < 100; u ++) {
+        status = mem_inspect_pool_snapshot(pool, segs, 10, &num_segs);
+        assert_int_equal(status, ALLOC_OK);
+        check_snapshot(segs, num_segs);
+    }
+    assert_int_equal(thrd_join(thread, &result), thrd_success);
+    assert_int_equal(result, 0);
+    check_pool(pool, exp);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, alloc2);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+
+    status = mem_inspect_pool_snapshot(pool, segs, 10, &num_segs);
+    assert_int_equal(status, ALLOC_OK);
+    assert_int_equal(num_segs, 2);
+    check_snapshot(segs, num_segs);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+/*******************************************/
+/***        6. STRESS TESTING            ***/
 /*******************************************/
 
 void test_pool_stresstest0(void **state) {
@@ -2393,7 +4332,7 @@ void test_pool_stresstest0(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
@@ -2431,6 +4370,34 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
+            // Extension tests
+            cmocka_unit_test_setup_teardown(test_pool_quick_lists, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_top_chunk, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_exact_fit, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test(test_pool_good_fit),
+            cmocka_unit_test_setup_teardown(test_pool_set_policy, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_auto_policy, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_alloc_hint, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_alloc_near, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_lifo_reuse, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_cache_align, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_size_classes, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_tcache, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_shared),
+            cmocka_unit_test(test_pool_group),
+            cmocka_unit_test(test_pool_remote_free),
+            cmocka_unit_test(test_pool_store),
+            cmocka_unit_test(test_pool_arena),
+            cmocka_unit_test(test_pool_slab),
+            cmocka_unit_test(test_pool_lanes),
+            cmocka_unit_test_setup_teardown(test_pool_tcache_depot, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_epoch, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_maintenance),
+            cmocka_unit_test(test_pool_alloc_wait),
+            cmocka_unit_test(test_pool_lock_stats),
+            cmocka_unit_test(test_pool_close_many),
+            cmocka_unit_test(test_pool_snapshot),
+
             // Stress tests
             cmocka_unit_test(test_pool_stresstest0),
     };